@@ -1,106 +1,108 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
-#include <dc42.h>
-#include <endianness.h>
-#include <fstream>
+#include <fcntl.h>
+#include <mactools/diskcopy42.h>
+#include <mactools/image.h>
+#include <mactools/trace.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
 
 // docs: https://www.discferret.com/wiki/Apple_DiskCopy_4.2
 
-static void read_file(std::fstream &file, size_t bytes, void *buf) {
-    file.read((char *)buf, bytes);
-    if (!file.good()) {
-        fprintf(stderr, "error reading file (%s)\n", std::strerror(errno));
+int main(int argc, char *argv[]) {
+    bool print_phases = false;
+    const char *trace_path = nullptr;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            print_phases = true;
+        } else if ((strcmp(argv[i], "--trace") == 0) && ((i + 1) < argc)) {
+            trace_path = argv[++i];
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() != 2) {
+        fprintf(stderr, "usage: %s [--stats] [--trace file] [input file] [output file]\n", argv[0]);
+        fprintf(stderr, "  --stats: print phase timings to stderr\n");
+        fprintf(stderr, "  --trace [file]: write the phases as Chrome trace event JSON\n");
         exit(1);
     }
-}
+    std::shared_ptr<image> infile = open_image(args[0]);
+    if (infile == nullptr) {
+        fprintf(stderr, "failed to open input file (%s)\n", std::strerror(errno));
+        exit(1);
+    }
+
+    // the output is written to a temporary file first and only renamed to its final name once the checksums are known to be good
+    std::string tmpname = std::string(args[1]) + ".tmp";
+    trace_log log;
+    try {
+        struct dc42_info header;
+        if (!dc42_probe(*infile, &header)) {
+            fprintf(stderr, "File was not recognized as a valid DiskCopy 4.2 image!\n");
+            exit(1);
+        }
 
-void streamcopy(std::fstream &in, std::fstream &out, size_t bytes, size_t bufsize) {
-    uint8_t *buffer = new uint8_t[bufsize];
-    while (bytes != 0) {
-        size_t chunksize = bytes > bufsize ? bufsize : bytes;
-        in.read((char *)buffer, chunksize);
-        if (!in.good()) {
-            fprintf(stderr, "error reading file (%s)\n", std::strerror(errno));
+        int outfd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (outfd < 0) {
+            fprintf(stderr, "failed to open output file (%s)\n", std::strerror(errno));
             exit(1);
         }
-        out.write((char *)buffer, chunksize);
-        if (!out.good()) {
+
+        uint32_t data_chksum;
+        std::unique_ptr<trace_span> phase(new trace_span(&log, "copy and checksum"));
+        try {
+            data_chksum = dc42_copy_checksum(*infile, DC42_HEADER_SIZE, outfd, header.data_size, 512 * 128);
+        } catch (...) {
+            close(outfd);
+            throw;
+        }
+        if (close(outfd) != 0) {
             fprintf(stderr, "error writing file (%s)\n", std::strerror(errno));
+            remove(tmpname.c_str());
             exit(1);
         }
-        bytes -= chunksize;
-    }
-    delete[] buffer;
-}
 
-static bool verify_chksum(std::fstream &file, struct dc42_header *header) {
-    file.seekg(sizeof(struct dc42_header), std::ios_base::beg);
-    uint32_t data_chksum = 0;
-    for (uint32_t i = 0; i < header->data_size / 2; i++) {
-        uint16_t word;
-        read_file(file, sizeof(word), &word);
-        word = swap_be(word);
-        data_chksum += word;
-        data_chksum = (data_chksum >> 1) | (data_chksum << 31);
-    }
-    if (data_chksum != header->data_chksum) {
-        fprintf(stderr, "Data checksum invalid!\n");
-        return false;
-    }
-    // the first 12 bytes of the tag section are skipped due to a bug in an old Apple DiskCopy version
-    if (header->tag_size > 12) {
-        uint32_t tag_chksum = 0;
-        file.seekg(sizeof(struct dc42_header) + header->data_size + 12, std::ios_base::beg);
-        for (uint32_t i = 0; i < (header->tag_size - 12) / 2; i++) {
-            uint16_t word;
-            read_file(file, sizeof(word), &word);
-            word = swap_be(word);
-            tag_chksum += word;
-            tag_chksum = (tag_chksum >> 1) | (tag_chksum << 31);
+        phase.reset(new trace_span(&log, "tag checksum"));
+        bool chksum_ok = true;
+        if (data_chksum != header.data_chksum) {
+            fprintf(stderr, "Data checksum invalid!\n");
+            chksum_ok = false;
         }
-        if (tag_chksum != header->tag_chksum) {
+        if (chksum_ok && !dc42_verify_tags(*infile, header)) {
             fprintf(stderr, "Tag checksum invalid!\n");
-            return false;
+            chksum_ok = false;
+        }
+        phase.reset();
+        if (!chksum_ok) {
+            fprintf(stderr, "Checksum invalid!\n");
+            remove(tmpname.c_str());
+            exit(1);
         }
-    }
-
-    return true;
-}
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "usage: %s [input file] [output file]\n", argv[0]);
-        exit(1);
-    }
-    std::fstream infile = std::fstream(argv[1], std::ios::in | std::ios::binary);
-    if (!infile.is_open()) {
-        fprintf(stderr, "failed to open input file (%s)\n", std::strerror(errno));
-        exit(1);
-    }
-    struct dc42_header header;
-    infile.seekg(0, std::ios_base::beg);
-    read_file(infile, sizeof(header), &header);
-    SWAP_DC42_HEADER(header);
-    if ((header.magic != DC42_HEADER_MAGIC) ||
-        ((header.data_size + header.tag_size + sizeof(header)) != infile.seekg(0, std::ios_base::end).tellg())) {
-        fprintf(stderr, "File was not recognized as a valid DiskCopy 4.2 image!\n");
+        if (rename(tmpname.c_str(), args[1]) != 0) {
+            fprintf(stderr, "failed to rename output file (%s)\n", std::strerror(errno));
+            remove(tmpname.c_str());
+            exit(1);
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "error extracting file (%s)\n", e.what());
+        remove(tmpname.c_str());
         exit(1);
     }
-    if (!verify_chksum(infile, &header)) {
-        fprintf(stderr, "Checksum invalid!\n");
-        exit(1);
+    fprintf(stderr, "Successfully extracted data from DiskCopy image!\n");
+    if (print_phases) {
+        // the copy runs in the kernel where possible, so there are no I/O counters to show
+        print_stats(stderr, {0, 0, 0, 0, 0, 0}, &log);
     }
-
-    std::fstream outfile = std::fstream(argv[2], std::ios::out | std::ios::binary);
-    if (!outfile.is_open()) {
-        fprintf(stderr, "failed to open output file (%s)\n", std::strerror(errno));
-        exit(1);
+    if ((trace_path != nullptr) && !log.write_chrome_trace(trace_path)) {
+        fprintf(stderr, "failed to write trace file (%s)\n", std::strerror(errno));
     }
 
-    infile.seekg(sizeof(struct dc42_header), std::ios_base::beg);
-    streamcopy(infile, outfile, header.data_size, 512 * 20);
-    fprintf(stderr, "Successfully extracted data from DiskCopy image!\n");
-
     return 0;
 }
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mactools/image.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// deterministic synthetic volumes, the same parameters always produce the same bytes
+struct synth_params {
+    size_t file_count;
+    double fragmentation;    // fraction of allocation blocks moved to random places, 0 -> every fork is contiguous
+    size_t alloc_block_size; // multiple of 512
+    uint32_t seed;
+};
+
+struct synth_volume {
+    std::vector<uint8_t> data;
+    std::vector<std::string> names; // in directory order
+};
+
+// builds an MFS volume with file_count files of up to three allocation blocks, every other file has a resource fork
+// throws std::runtime_error if the files don't fit into the 4094 allocation blocks MFS can address
+struct synth_volume synth_mfs_volume(const struct synth_params &params);
+
+// wraps a disk image into a DiskCopy 4.2 image with valid checksums and no tags
+std::vector<uint8_t> synth_dc42_image(const std::vector<uint8_t> &disk);
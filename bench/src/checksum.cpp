@@ -0,0 +1,101 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <mactools/diskcopy42.h>
+#include <synth.h>
+#include <unistd.h>
+#include <vector>
+
+// the word at a time loop diskcopy-extract used to run, for comparison
+static uint32_t chksum_reference(const uint8_t *data, size_t words) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < words; i++) {
+        uint16_t word = ((uint16_t)data[i * 2] << 8) | data[(i * 2) + 1];
+        sum += word;
+        sum = (sum >> 1) | (sum << 31);
+    }
+    return sum;
+}
+
+static std::vector<uint8_t> random_data(size_t size) {
+    std::vector<uint8_t> ret(size);
+    uint32_t x = 0x12345678;
+    for (auto &b : ret) {
+        // xorshift32
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        b = (uint8_t)x;
+    }
+    return ret;
+}
+
+static void BM_dc42_checksum_reference(benchmark::State &state) {
+    std::vector<uint8_t> data = random_data(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(chksum_reference(data.data(), data.size() / 2));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_dc42_checksum_reference)->Arg(400 * 1024)->Arg(800 * 1024);
+
+static void BM_dc42_checksum_update(benchmark::State &state) {
+    std::vector<uint8_t> data = random_data(state.range(0));
+    if (dc42_checksum_update(0, data.data(), data.size() / 2) != chksum_reference(data.data(), data.size() / 2)) {
+        state.SkipWithError("checksum mismatch");
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(dc42_checksum_update(0, data.data(), data.size() / 2));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_dc42_checksum_update)->Arg(400 * 1024)->Arg(800 * 1024);
+
+// synthetic 800K disk wrapped in DiskCopy 4.2
+static std::vector<uint8_t> dc42_volume() {
+    return synth_dc42_image(synth_mfs_volume({300, 0.0, 1024, 1}).data);
+}
+
+static void BM_dc42_verify(benchmark::State &state) {
+    std::vector<uint8_t> data = dc42_volume();
+    memory_image img(data.data(), data.size());
+    struct dc42_info info;
+    if (!dc42_probe(img, &info)) {
+        state.SkipWithError("not a DiskCopy 4.2 image");
+        return;
+    }
+    for (auto _ : state) {
+        if (!dc42_verify_data(img, info)) {
+            state.SkipWithError("checksum mismatch");
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * info.data_size);
+}
+BENCHMARK(BM_dc42_verify);
+
+// the diskcopy-extract pipeline into /dev/null, Arg(0) = 1 reads the image from a file (kernel copies) instead of memory
+static void BM_dc42_copy_checksum(benchmark::State &state) {
+    std::vector<uint8_t> data = dc42_volume();
+    std::shared_ptr<image> img = std::make_shared<memory_image>(data.data(), data.size());
+    char path[] = "/tmp/mactools-bench-XXXXXX";
+    if (state.range(0) != 0) {
+        int fd = mkstemp(path);
+        write_all(fd, data.data(), data.size());
+        close(fd);
+        img = open_image(path);
+        unlink(path);
+    }
+    struct dc42_info info;
+    dc42_probe(*img, &info);
+    int out_fd = open("/dev/null", O_WRONLY);
+    for (auto _ : state) {
+        if (dc42_copy_checksum(*img, DC42_HEADER_SIZE, out_fd, info.data_size, 512 * 128) != info.data_chksum) {
+            state.SkipWithError("checksum mismatch");
+        }
+    }
+    close(out_fd);
+    state.SetBytesProcessed(state.iterations() * info.data_size);
+}
+BENCHMARK(BM_dc42_copy_checksum)->Arg(0)->Arg(1);
@@ -0,0 +1,98 @@
+#include <benchmark/benchmark.h>
+#include <mactools/mfsro.h>
+#include <random>
+#include <synth.h>
+#include <vector>
+
+// benchmarks of the embedded driver on in-memory volumes, Arg(0) is the file count, Arg(1) the fragmentation in percent
+// and Arg(2) the allocation block size
+
+static struct synth_volume volume_for(const benchmark::State &state) {
+    return synth_mfs_volume({(size_t)state.range(0), state.range(1) / 100.0, (size_t)state.range(2), 1});
+}
+
+static void read_memory(void *disk, void *buf, size_t count, size_t offset) {
+    ((image *)disk)->read(buf, count, offset);
+}
+
+static void BM_init_mfs_driver(benchmark::State &state) {
+    struct synth_volume volume = volume_for(state);
+    memory_image disk(volume.data.data(), volume.data.size());
+    for (auto _ : state) {
+        struct mfs_driver_state ctx;
+        if (init_mfs_driver(&ctx, read_memory, &disk, 0) != 0) {
+            state.SkipWithError("init_mfs_driver failed");
+        }
+        deinit_mfs_driver(&ctx);
+    }
+}
+BENCHMARK(BM_init_mfs_driver)->ArgsProduct({{100, 1000}, {0}, {512, 1024, 4096}});
+
+// mfs_find_file is internal, opening a file is a lookup plus building its (short) extent list
+static void BM_mfs_find_file(benchmark::State &state) {
+    struct synth_volume volume = volume_for(state);
+    memory_image disk(volume.data.data(), volume.data.size());
+    struct mfs_driver_state ctx;
+    init_mfs_driver(&ctx, read_memory, &disk, 0);
+    std::mt19937 rng(1);
+    for (auto _ : state) {
+        struct mfs_file_handle file;
+        if (!mfs_open_file(&ctx, &file, volume.names[rng() % volume.names.size()].c_str())) {
+            state.SkipWithError("file not found");
+        }
+        mfs_close_file(&ctx, &file);
+    }
+    deinit_mfs_driver(&ctx);
+}
+BENCHMARK(BM_mfs_find_file)->ArgsProduct({{100, 1000}, {0}, {512, 1024, 4096}});
+
+// reads every file front to back in Arg(3) sized chunks
+static void BM_mfs_read_sequential(benchmark::State &state) {
+    struct synth_volume volume = volume_for(state);
+    memory_image disk(volume.data.data(), volume.data.size());
+    struct mfs_driver_state ctx;
+    init_mfs_driver(&ctx, read_memory, &disk, 0);
+    std::vector<uint8_t> buf(state.range(3));
+    size_t bytes = 0;
+    for (auto _ : state) {
+        for (const auto &name : volume.names) {
+            struct mfs_file_handle file;
+            mfs_open_file(&ctx, &file, name.c_str());
+            uint32_t n;
+            while ((n = mfs_read(&ctx, &file, buf.data(), buf.size())) != 0) {
+                bytes += n;
+            }
+            mfs_close_file(&ctx, &file);
+        }
+    }
+    state.SetBytesProcessed(bytes);
+    deinit_mfs_driver(&ctx);
+}
+BENCHMARK(BM_mfs_read_sequential)->ArgsProduct({{1000}, {0, 100}, {512, 1024, 4096}, {4096, 512}});
+
+// Arg(3) sized reads at random offsets of random files, all files are kept open
+static void BM_mfs_read_random(benchmark::State &state) {
+    struct synth_volume volume = volume_for(state);
+    memory_image disk(volume.data.data(), volume.data.size());
+    struct mfs_driver_state ctx;
+    init_mfs_driver(&ctx, read_memory, &disk, 0);
+    std::vector<struct mfs_file_handle> files(volume.names.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        mfs_open_file(&ctx, &files[i], volume.names[i].c_str());
+    }
+    std::vector<uint8_t> buf(state.range(3));
+    std::mt19937 rng(1);
+    size_t bytes = 0;
+    for (auto _ : state) {
+        struct mfs_file_handle &file = files[rng() % files.size()];
+        uint32_t size = file.dirent.flLgLen;
+        mfs_seek(&ctx, &file, size != 0 ? rng() % size : 0, MFS_SEEK_BEGIN);
+        bytes += mfs_read(&ctx, &file, buf.data(), buf.size());
+    }
+    state.SetBytesProcessed(bytes);
+    for (auto &file : files) {
+        mfs_close_file(&ctx, &file);
+    }
+    deinit_mfs_driver(&ctx);
+}
+BENCHMARK(BM_mfs_read_random)->ArgsProduct({{1000}, {0, 100}, {512, 1024, 4096}, {512}});
@@ -0,0 +1,27 @@
+#include <benchmark/benchmark.h>
+#include <common.h>
+#include <synth.h>
+
+// benchmarks of the mfstools volume class, Arg(0) is the file count and Arg(1) the allocation block size
+
+static void BM_mfs_init_readonly(benchmark::State &state) {
+    struct synth_volume volume = synth_mfs_volume({(size_t)state.range(0), 0.0, (size_t)state.range(1), 1});
+    mfs mfs(std::make_shared<memory_image>(volume.data.data(), volume.data.size()));
+    for (auto _ : state) {
+        if (!mfs.init_readonly()) {
+            state.SkipWithError("init_readonly failed");
+        }
+    }
+}
+BENCHMARK(BM_mfs_init_readonly)->ArgsProduct({{100, 1000}, {512, 1024, 4096}});
+
+static void BM_mfs_readdir(benchmark::State &state) {
+    struct synth_volume volume = synth_mfs_volume({(size_t)state.range(0), 0.0, (size_t)state.range(1), 1});
+    mfs mfs(std::make_shared<memory_image>(volume.data.data(), volume.data.size()));
+    mfs.init_readonly();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mfs.readdir());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_mfs_readdir)->ArgsProduct({{100, 1000}, {512, 1024, 4096}});
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <mactools/diskcopy42.h>
+#include <mactools/endian.h>
+#include <mactools/mfs.h>
+#include <random>
+#include <synth.h>
+
+#define SECTOR_SIZE       (512)
+#define MDB_SIZE          (37 + 27) // MDB including the volume name
+#define DIRENT_SIZE       (51)      // directory entry without the name
+#define DC42_DISK_NAME    "synthetic"
+#define SYNTH_VOLUME_NAME "Synthetic"
+#define SYNTH_TIMESTAMP   (0xB5D9E0A0) // some day in 2000
+
+static size_t round_up(size_t v, size_t align) {
+    return ((v + align - 1) / align) * align;
+}
+
+struct synth_fork {
+    size_t size;
+    size_t first_block; // index into the block order
+    size_t block_count;
+};
+
+struct synth_volume synth_mfs_volume(const struct synth_params &params) {
+    if ((params.alloc_block_size == 0) || ((params.alloc_block_size % SECTOR_SIZE) != 0)) {
+        throw std::runtime_error("allocation block size must be a multiple of 512");
+    }
+    // std::mt19937 output is specified by the standard, the distributions are not, so only raw values are used
+    std::mt19937 rng(params.seed);
+    struct synth_volume ret;
+
+    // fork sizes and names
+    std::vector<struct synth_fork> forks;
+    size_t used_blocks = 0;
+    size_t directory_size = 0;
+    for (size_t i = 0; i < params.file_count; i++) {
+        ret.names.push_back("File " + std::to_string(i));
+        for (int resource_fork = 0; resource_fork < 2; resource_fork++) {
+            size_t size = 0;
+            if (!resource_fork) {
+                size = rng() % (3 * params.alloc_block_size);
+            } else if ((i % 2) != 0) {
+                size = rng() % params.alloc_block_size;
+            }
+            size_t blocks = (size + params.alloc_block_size - 1) / params.alloc_block_size;
+            forks.push_back({size, used_blocks, blocks});
+            used_blocks += blocks;
+        }
+        size_t entry_size = round_up(DIRENT_SIZE + ret.names.back().size(), 2);
+        if (((directory_size % SECTOR_SIZE) + entry_size) > SECTOR_SIZE) {
+            directory_size = round_up(directory_size, SECTOR_SIZE);
+        }
+        directory_size += entry_size;
+    }
+    // leave some free space
+    size_t block_count = used_blocks + (used_blocks / 10) + 1;
+    if (block_count > MFS_MAX_ALLOC_BLOCKS) {
+        throw std::runtime_error("synthetic volume doesn't fit into " + std::to_string(MFS_MAX_ALLOC_BLOCKS) + " allocation blocks");
+    }
+
+    // boot blocks, MDB with the allocation block map, directory, allocation blocks
+    size_t map_size = ((block_count * 3) + 1) / 2;
+    size_t directory_start = round_up((SECTOR_SIZE * 2) + MDB_SIZE + map_size, SECTOR_SIZE) / SECTOR_SIZE;
+    size_t directory_sectors = std::max(round_up(directory_size, SECTOR_SIZE) / SECTOR_SIZE, (size_t)1);
+    size_t alloc_start = directory_start + directory_sectors;
+    ret.data.assign((alloc_start * SECTOR_SIZE) + (block_count * params.alloc_block_size), 0);
+    uint8_t *disk = ret.data.data();
+
+    // block order, a partial shuffle moves the requested fraction of blocks
+    std::vector<uint16_t> order(used_blocks);
+    for (size_t i = 0; i < used_blocks; i++) {
+        order[i] = i + 2;
+    }
+    for (size_t i = 0; i < used_blocks; i++) {
+        if ((rng() % 1000000) < (params.fragmentation * 1000000)) {
+            std::swap(order[i], order[i + (rng() % (used_blocks - i))]);
+        }
+    }
+
+    std::vector<uint16_t> alloc_map(block_count, 0);
+    for (const auto &fork : forks) {
+        for (size_t i = 0; i < fork.block_count; i++) {
+            uint16_t block = order[fork.first_block + i];
+            alloc_map[block - 2] = (i + 1) < fork.block_count ? order[fork.first_block + i + 1] : 1;
+            uint8_t *p = &disk[(alloc_start * SECTOR_SIZE) + ((block - 2) * params.alloc_block_size)];
+            size_t amount = std::min(params.alloc_block_size, fork.size - (i * params.alloc_block_size));
+            for (size_t j = 0; j < amount; j++) {
+                p[j] = (uint8_t)rng();
+            }
+        }
+    }
+
+    // MDB
+    uint8_t *mdb = &disk[SECTOR_SIZE * 2];
+    store_be<uint16_t>(&mdb[0], 0xD2D7);
+    store_be<uint32_t>(&mdb[2], SYNTH_TIMESTAMP);
+    store_be<uint16_t>(&mdb[12], params.file_count);
+    store_be<uint16_t>(&mdb[14], directory_start);
+    store_be<uint16_t>(&mdb[16], directory_sectors);
+    store_be<uint16_t>(&mdb[18], block_count);
+    store_be<uint32_t>(&mdb[20], params.alloc_block_size);
+    store_be<uint32_t>(&mdb[24], params.alloc_block_size);
+    store_be<uint16_t>(&mdb[28], alloc_start);
+    store_be<uint32_t>(&mdb[30], params.file_count + 1);
+    store_be<uint16_t>(&mdb[34], block_count - used_blocks);
+    mdb[36] = strlen(SYNTH_VOLUME_NAME);
+    memcpy(&mdb[37], SYNTH_VOLUME_NAME, strlen(SYNTH_VOLUME_NAME));
+
+    // allocation block map
+    uint8_t *packed = &mdb[MDB_SIZE];
+    for (size_t i = 0; i < block_count; i++) {
+        size_t offset = i + (i / 2);
+        if ((i & 0x01) != 0) {
+            packed[offset] |= alloc_map[i] >> 8;
+            packed[offset + 1] = alloc_map[i];
+        } else {
+            packed[offset] = alloc_map[i] >> 4;
+            packed[offset + 1] |= (alloc_map[i] & 0x0F) << 4;
+        }
+    }
+
+    // directory
+    uint8_t *directory = &disk[directory_start * SECTOR_SIZE];
+    size_t offset = 0;
+    for (size_t i = 0; i < params.file_count; i++) {
+        const std::string &name = ret.names[i];
+        size_t entry_size = round_up(DIRENT_SIZE + name.size(), 2);
+        if (((offset % SECTOR_SIZE) + entry_size) > SECTOR_SIZE) {
+            offset = round_up(offset, SECTOR_SIZE);
+        }
+        uint8_t *e = &directory[offset];
+        const struct synth_fork &data = forks[i * 2];
+        const struct synth_fork &rsrc = forks[(i * 2) + 1];
+        e[0] = 0x80; // used
+        memcpy(&e[2], "TEXTttxt", 8);
+        store_be<uint32_t>(&e[18], i + 1);
+        store_be<uint16_t>(&e[22], data.block_count != 0 ? order[data.first_block] : 0);
+        store_be<uint32_t>(&e[24], data.size);
+        store_be<uint32_t>(&e[28], data.block_count * params.alloc_block_size);
+        store_be<uint16_t>(&e[32], rsrc.block_count != 0 ? order[rsrc.first_block] : 0);
+        store_be<uint32_t>(&e[34], rsrc.size);
+        store_be<uint32_t>(&e[38], rsrc.block_count * params.alloc_block_size);
+        store_be<uint32_t>(&e[42], SYNTH_TIMESTAMP);
+        store_be<uint32_t>(&e[46], SYNTH_TIMESTAMP);
+        e[50] = name.size();
+        memcpy(&e[51], name.data(), name.size());
+        offset += entry_size;
+    }
+    return ret;
+}
+
+std::vector<uint8_t> synth_dc42_image(const std::vector<uint8_t> &disk) {
+    std::vector<uint8_t> ret(DC42_HEADER_SIZE + disk.size(), 0);
+    ret[0] = strlen(DC42_DISK_NAME);
+    memcpy(&ret[1], DC42_DISK_NAME, strlen(DC42_DISK_NAME));
+    store_be<uint32_t>(&ret[0x40], disk.size());
+    store_be<uint32_t>(&ret[0x48], dc42_checksum_update(0, disk.data(), disk.size() / 2));
+    ret[0x50] = 0x02; // 800K
+    ret[0x51] = 0x22; // Mac format
+    store_be<uint16_t>(&ret[0x52], 0x0100);
+    std::copy(disk.begin(), disk.end(), ret.begin() + DC42_HEADER_SIZE);
+    return ret;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mactools/endian.h>
+#include <mactools/image.h>
+#include <memory>
+
+// docs: https://www.discferret.com/wiki/Apple_DiskCopy_4.2
+
+#define DC42_HEADER_SIZE  (0x54)
+#define DC42_HEADER_MAGIC (0x0100)
+
+struct __attribute__((packed)) dc42_header {
+    uint8_t name_len;
+    uint8_t name[63];
+    uint32_t data_size;
+    uint32_t tag_size;
+    uint32_t data_chksum;
+    uint32_t tag_chksum;
+    uint8_t disk_encoding;
+    uint8_t format;
+    uint16_t magic;
+};
+
+typedef be_struct<dc42_header,
+                  MACTOOLS_BE_FIELD(dc42_header, data_size),
+                  MACTOOLS_BE_FIELD(dc42_header, tag_size),
+                  MACTOOLS_BE_FIELD(dc42_header, data_chksum),
+                  MACTOOLS_BE_FIELD(dc42_header, tag_chksum),
+                  MACTOOLS_BE_FIELD(dc42_header, magic)>
+    dc42_header_codec;
+
+struct dc42_info {
+    size_t data_size;
+    size_t tag_size;
+    uint32_t data_chksum;
+    uint32_t tag_chksum;
+};
+
+// returns true and fills in info if img looks like a DiskCopy 4.2 image (header magic and section sizes match)
+bool dc42_probe(image &img, struct dc42_info *info);
+
+// continues a DiskCopy 4.2 checksum over words big endian 16-bit words at data, start with sum = 0
+// every step adds a word and rotates right by one, so the whole thing is one serial dependency chain; this is why it's an
+// unrolled scalar loop reading four words per load instead of a SIMD kernel
+uint32_t dc42_checksum_update(uint32_t sum, const uint8_t *data, size_t words);
+
+// DiskCopy 4.2 checksum over bytes (rounded down to whole 16-bit words) starting at offset
+uint32_t dc42_checksum(image &img, size_t offset, size_t bytes);
+
+// copies bytes starting at offset of the image to out_fd in chunks of bufsize (must be even) and returns the DiskCopy checksum over them
+// a reader thread checksums the next chunk while the current one is being written, every byte is only read once by us;
+// chunks of file backed images are then handed to the kernel to copy instead of being written from userspace
+// throws std::runtime_error on errors
+uint32_t dc42_copy_checksum(image &in, size_t offset, int out_fd, size_t bytes, size_t bufsize);
+
+// checks the data and tag checksums of a probed image
+bool dc42_verify_data(image &img, const struct dc42_info &info);
+bool dc42_verify_tags(image &img, const struct dc42_info &info);
+
+// recalculates the data checksum of a probed image after its disk image was modified and writes it to the header
+void dc42_update_data_checksum(image &img, struct dc42_info &info);
+
+// returns the disk image contained in a DiskCopy 4.2 image, or img itself if it isn't one
+// throws std::runtime_error if verify is set and a checksum doesn't match
+std::shared_ptr<image> dc42_unwrap(std::shared_ptr<image> img, bool verify);
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// big endian codec for on-disk structures, header only so the loads inline into directory scans and compile down to a load + bswap
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ || defined(__BIG_ENDIAN__)
+#define MACTOOLS_HOST_BIG_ENDIAN 1
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ || defined(__LITTLE_ENDIAN__) || defined(_WIN32)
+#define MACTOOLS_HOST_BIG_ENDIAN 0
+#else
+#error "unable to determine the byte order of this machine at compile time"
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+constexpr uint8_t bswap(uint8_t x) {
+    return x;
+}
+constexpr uint16_t bswap(uint16_t x) {
+    return __builtin_bswap16(x);
+}
+constexpr uint32_t bswap(uint32_t x) {
+    return __builtin_bswap32(x);
+}
+constexpr uint64_t bswap(uint64_t x) {
+    return __builtin_bswap64(x);
+}
+#else
+// compilers recognize these shift patterns as bswap too
+constexpr uint8_t bswap(uint8_t x) {
+    return x;
+}
+constexpr uint16_t bswap(uint16_t x) {
+    return (uint16_t)((x >> 8) | (x << 8));
+}
+constexpr uint32_t bswap(uint32_t x) {
+    return ((x >> 24) & 0xFF) | ((x >> 8) & 0xFF00) | ((x << 8) & 0xFF0000) | (x << 24);
+}
+constexpr uint64_t bswap(uint64_t x) {
+    return ((uint64_t)bswap((uint32_t)x) << 32) | bswap((uint32_t)(x >> 32));
+}
+#endif
+
+template <typename T> constexpr T from_be(T x) {
+    return MACTOOLS_HOST_BIG_ENDIAN ? x : bswap(x);
+}
+
+template <typename T> constexpr T to_be(T x) {
+    return from_be(x);
+}
+
+// unaligned loads/stores, memcpy of a constant size is a single mov
+template <typename T> inline T load_be(const uint8_t *p) {
+    T x;
+    memcpy(&x, p, sizeof(x));
+    return from_be(x);
+}
+
+template <typename T> inline void store_be(uint8_t *p, T x) {
+    x = to_be(x);
+    memcpy(p, &x, sizeof(x));
+}
+
+template <typename T> inline T load_le(const uint8_t *p) {
+    T x;
+    memcpy(&x, p, sizeof(x));
+    return MACTOOLS_HOST_BIG_ENDIAN ? bswap(x) : x;
+}
+
+// one big endian integer member of S, stored Offset bytes into the on-disk record
+// members of packed structs may be misaligned, so they are accessed with memcpy instead of through a member pointer
+template <typename S, typename T, size_t Offset> struct be_field {
+    static void decode(S &s, const uint8_t *p) {
+        T x = load_be<T>(p + Offset);
+        memcpy((uint8_t *)&s + Offset, &x, sizeof(x));
+    }
+    static void encode(const S &s, uint8_t *p) {
+        T x;
+        memcpy(&x, (const uint8_t *)&s + Offset, sizeof(x));
+        store_be<T>(p + Offset, x);
+    }
+};
+
+// a packed struct S whose in-memory layout matches the on-disk record, Fields lists the members that need byte swapping
+// everything else (flags, byte arrays, string lengths) is copied as is
+template <typename S, typename... Fields> struct be_struct {
+    static const size_t size = sizeof(S);
+
+    static void decode(S &s, const uint8_t *p) {
+        memcpy(&s, p, sizeof(S));
+        int expand[] = {0, (Fields::decode(s, p), 0)...};
+        (void)expand;
+    }
+    static S decode(const uint8_t *p) {
+        S s;
+        decode(s, p);
+        return s;
+    }
+    static void encode(const S &s, uint8_t *p) {
+        memcpy(p, &s, sizeof(S));
+        int expand[] = {0, (Fields::encode(s, p), 0)...};
+        (void)expand;
+    }
+};
+
+#define MACTOOLS_BE_FIELD(S, member) be_field<S, decltype(S::member), offsetof(S, member)>
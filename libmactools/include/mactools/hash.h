@@ -0,0 +1,21 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// streaming XXH64 (https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md), several GB/s per core so hashing
+// whole forks costs about as much as reading them; not a cryptographic hash
+class xxh64 {
+public:
+    xxh64(uint64_t seed = 0);
+
+    void update(const void *data, size_t size);
+    // hash of everything passed to update() so far, more data may be added afterwards
+    uint64_t digest() const;
+
+private:
+    uint64_t _seed;
+    uint64_t _acc[4];
+    uint64_t _total;
+    uint8_t _buf[32]; // partial stripe
+    size_t _buffered;
+};
@@ -0,0 +1,179 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// random access to a disk image file
+class image {
+public:
+    virtual ~image() {}
+
+    virtual size_t size() const = 0;
+
+    // returns a pointer to count bytes at offset, throws std::runtime_error if the range is outside of the image
+    // if persistent_views() is true the pointer stays valid for the lifetime of the image, otherwise only until the next view() call
+    virtual const uint8_t *view(size_t offset, size_t count) = 0;
+    virtual bool persistent_views() const = 0;
+
+    // copies count bytes at offset into buf, throws std::runtime_error if the range is outside of the image
+    void read(void *buf, size_t count, size_t offset);
+
+    // returns the file descriptor backing the image and turns offset into an offset in that file, -1 if there is none
+    virtual int backing_fd(size_t &offset) const {
+        return -1;
+    }
+
+    // hints that the range will be read soon, doesn't do anything unless the backend can make use of it
+    virtual void prefetch(size_t offset, size_t count) {}
+
+    virtual bool writable() const {
+        return false;
+    }
+    // copies count bytes from buf to offset, views of that range see the new data afterwards
+    // throws std::runtime_error if the image isn't writable or the range is outside of the image
+    virtual void write(const void *buf, size_t count, size_t offset);
+};
+
+// the whole file mapped read-only into memory, views point straight into the mapping
+// doesn't have any mutable state, so a single instance can be read from multiple threads
+class mmap_image : public image {
+public:
+    // takes ownership of the mapping and the file descriptor it was created from
+    // writable images need a shared mapping of a file opened for writing, writes go through the file descriptor
+    mmap_image(const uint8_t *data, size_t size, int fd, bool writable = false);
+    ~mmap_image();
+
+    size_t size() const override;
+    const uint8_t *view(size_t offset, size_t count) override;
+    bool persistent_views() const override;
+    int backing_fd(size_t &offset) const override;
+    void prefetch(size_t offset, size_t count) override;
+    bool writable() const override;
+    void write(const void *buf, size_t count, size_t offset) override;
+
+private:
+    const uint8_t *_data;
+    size_t _size;
+    int _fd;
+    bool _writable;
+};
+
+// a buffer owned by the caller, which has to keep it alive and unchanged for the lifetime of the image
+// doesn't have any mutable state, so a single instance can be read from multiple threads
+class memory_image : public image {
+public:
+    memory_image(const uint8_t *data, size_t size);
+
+    size_t size() const override;
+    const uint8_t *view(size_t offset, size_t count) override;
+    bool persistent_views() const override;
+
+private:
+    const uint8_t *_data;
+    size_t _size;
+};
+
+// fallback for when mmap is not available, views are copied into an internal buffer
+// not thread safe
+class stream_image : public image {
+public:
+    stream_image(std::shared_ptr<std::iostream> stream);
+
+    size_t size() const override;
+    const uint8_t *view(size_t offset, size_t count) override;
+    bool persistent_views() const override;
+    bool writable() const override;
+    void write(const void *buf, size_t count, size_t offset) override;
+
+private:
+    std::shared_ptr<std::iostream> _stream;
+    size_t _size;
+    std::vector<uint8_t> _buf;
+};
+
+// a range of another image, e.g. the disk image inside a container
+class slice_image : public image {
+public:
+    // throws std::runtime_error if the range is outside of parent
+    slice_image(std::shared_ptr<image> parent, size_t offset, size_t size);
+
+    size_t size() const override;
+    const uint8_t *view(size_t offset, size_t count) override;
+    bool persistent_views() const override;
+    int backing_fd(size_t &offset) const override;
+    void prefetch(size_t offset, size_t count) override;
+    bool writable() const override;
+    void write(const void *buf, size_t count, size_t offset) override;
+
+private:
+    std::shared_ptr<image> _parent;
+    size_t _offset;
+    size_t _size;
+};
+
+enum cache_policy {
+    CACHE_LRU,   // evicts the least recently used page
+    CACHE_CLOCK, // second chance, cheaper bookkeeping on hits
+};
+
+struct cache_stats {
+    uint64_t hits;
+    uint64_t misses; // each one is a single aligned read of one page from the parent
+    uint64_t evictions;
+};
+
+// keeps a bounded number of fixed size, sector aligned pages of another image in memory, for backends where every read is
+// expensive (network block devices, compressed containers, streams); writes go through to the parent and update cached pages
+// views within a single page point into the cache, not thread safe
+class cached_image : public image {
+public:
+    // throws std::runtime_error if page_size isn't a multiple of the 512 byte sector size
+    cached_image(std::shared_ptr<image> parent, size_t page_size, size_t page_count, enum cache_policy policy = CACHE_LRU);
+
+    size_t size() const override;
+    const uint8_t *view(size_t offset, size_t count) override;
+    bool persistent_views() const override;
+    int backing_fd(size_t &offset) const override;
+    void prefetch(size_t offset, size_t count) override;
+    bool writable() const override;
+    void write(const void *buf, size_t count, size_t offset) override;
+
+    const struct cache_stats &stats() const;
+
+private:
+    const uint8_t *page(size_t index);
+    size_t victim();
+
+    struct cache_slot {
+        size_t index; // page index, SIZE_MAX if unused
+        bool referenced;
+        std::vector<uint8_t> data;
+        std::list<size_t>::iterator lru; // position in _lru
+    };
+
+    std::shared_ptr<image> _parent;
+    size_t _page_size;
+    enum cache_policy _policy;
+    std::vector<struct cache_slot> _slots;
+    std::unordered_map<size_t, size_t> _index; // page index -> slot
+    std::list<size_t> _lru;                    // slots, most recently used first
+    size_t _hand;                              // next slot the clock looks at
+    struct cache_stats _stats;
+    std::vector<uint8_t> _buf; // views spanning multiple pages are assembled here
+};
+
+// opens path as mmap_image if possible and falls back to stream_image, optionally for writing
+// returns nullptr (with errno set) if the file can't be opened
+std::shared_ptr<image> open_image(const char *path, bool writable = false);
+
+// writes count bytes at offset of the image to out_fd
+// file backed images are copied inside the kernel with copy_file_range or sendfile, everything else falls back to writing views
+// throws std::runtime_error on errors
+void copy_image_range(image &img, size_t offset, size_t count, int out_fd);
+
+// write() that retries until everything is written, throws std::runtime_error on errors
+void write_all(int fd, const void *buf, size_t count);
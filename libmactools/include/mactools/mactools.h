@@ -0,0 +1,78 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// C interface of the shared library (libmactools.so), for mounting MFS images in-process from other languages (ctypes, cgo, ...)
+// this is the only part of libmactools with a stable ABI: types are opaque or plain C structs, nothing here throws
+// a volume and the files opened on it must not be used from multiple threads at once, separate volumes are independent
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MACTOOLS_API __attribute__((visibility("default")))
+#else
+#define MACTOOLS_API
+#endif
+
+// bumped whenever a function or struct in this header changes incompatibly
+#define MACTOOLS_ABI_VERSION (1)
+
+#define MACTOOLS_OK            (0)
+#define MACTOOLS_ERR_IO        (-1) // the image couldn't be opened or read, errno has details
+#define MACTOOLS_ERR_FORMAT    (-2) // not an MFS volume or a corrupt one
+#define MACTOOLS_ERR_CHECKSUM  (-3) // DiskCopy 4.2 checksum mismatch
+#define MACTOOLS_ERR_NOT_FOUND (-4)
+#define MACTOOLS_ERR_INVALID   (-5) // invalid argument
+#define MACTOOLS_ERR_NO_MEMORY (-6)
+
+// mount flags
+#define MACTOOLS_MOUNT_VERIFY (1 << 0) // check the checksums of DiskCopy 4.2 images
+
+#define MACTOOLS_FORK_DATA     (0)
+#define MACTOOLS_FORK_RESOURCE (1)
+
+#define MACTOOLS_FILE_LOCKED (1 << 0)
+
+typedef struct mactools_volume mactools_volume;
+typedef struct mactools_file mactools_file;
+
+typedef struct mactools_dirent {
+    char name[256]; // Mac OS Roman, null terminated
+    uint32_t file_number;
+    uint32_t data_size; // logical fork sizes in bytes
+    uint32_t rsrc_size;
+    uint32_t create_date; // seconds since 1904-01-01 00:00 local time
+    uint32_t modify_date;
+    uint8_t finder_info[16]; // file type, creator, Finder flags, icon position and folder
+    uint32_t flags;          // MACTOOLS_FILE_*
+} mactools_dirent;
+
+// returns MACTOOLS_ABI_VERSION of the loaded library, callers should check it against the one they were written for
+MACTOOLS_API int mactools_abi_version(void);
+MACTOOLS_API const char *mactools_strerror(int err);
+
+// mounts a raw MFS image or one wrapped in a DiskCopy 4.2 image
+MACTOOLS_API int mactools_mount_file(const char *path, unsigned flags, mactools_volume **volume);
+// same for an image in memory, data has to stay valid and unchanged until mactools_unmount
+MACTOOLS_API int mactools_mount_memory(const void *data, size_t size, unsigned flags, mactools_volume **volume);
+// also closes all files still open on the volume
+MACTOOLS_API void mactools_unmount(mactools_volume *volume);
+
+// null terminated, valid until mactools_unmount
+MACTOOLS_API const char *mactools_volume_name(const mactools_volume *volume);
+MACTOOLS_API size_t mactools_file_count(const mactools_volume *volume);
+// fills in entry number index in directory order, MACTOOLS_ERR_NOT_FOUND if index >= mactools_file_count
+MACTOOLS_API int mactools_readdir(const mactools_volume *volume, size_t index, mactools_dirent *entry);
+
+// fork is MACTOOLS_FORK_*
+MACTOOLS_API int mactools_open(mactools_volume *volume, const char *name, int fork, mactools_file **file);
+MACTOOLS_API uint64_t mactools_file_size(const mactools_file *file);
+// reads up to count bytes at offset, returns the amount of bytes read (0 at the end of the fork) or a negative error
+MACTOOLS_API int64_t mactools_read(mactools_file *file, void *buf, size_t count, uint64_t offset);
+MACTOOLS_API void mactools_close(mactools_file *file);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,122 @@
+#pragma once
+#include <cstddef>
+#include <mactools/endian.h>
+#include <stdint.h>
+#include <string>
+
+// Data structures from Inside Macintosh II pages 119-123
+
+struct __attribute__((packed)) mfs_mdb {
+    uint16_t drSigWord;  // should be MFS_MDB_SIGNATURE
+    uint32_t drCrDate;   // initialisation timestamp
+    uint32_t drLsBkUp;   // last backup timestamp
+    uint16_t drAtrb;     // attributes
+    uint16_t drNmFls;    // number of files in directory
+    uint16_t drDirSt;    // first block of directory
+    uint16_t drBlLen;    // size of directory in blocks
+    uint16_t drNmAlBlks; // number of allocation blocks on volume
+    uint32_t drAlBlkSiz; // size of allocation blocks
+    uint32_t drClpSiz;   // clump size in bytes
+    uint16_t drAlBiSt;   // first allocation block sector
+    uint32_t drNxtFNum;  // next unused file number
+    uint16_t drFreeBks;  // number of unused allocation blocks
+    uint8_t drVN;        // length of volume name
+    // volume name string follows - 27 bytes long
+};
+#define MFS_MDB_SIGNATURE (0xD2D7)
+
+#define MFS_SECTOR_SIZE     (512)
+#define MFS_MDB_OFFSET      (MFS_SECTOR_SIZE * 2) // after the boot blocks
+#define MFS_VOLUME_NAME_MAX (27)
+// the allocation block map follows the MDB and volume name and takes up the rest of the MDB sectors
+#define MFS_ALLOC_BLOCK_MAP_OFFSET (MFS_MDB_OFFSET + sizeof(struct mfs_mdb) + MFS_VOLUME_NAME_MAX)
+
+#define MFS_ALLOC_BLOCK_MAP_FREE    (0)
+#define MFS_ALLOC_BLOCK_MAP_LAST    (1)
+#define MFS_ALLOC_BLOCK_MAP_DIRENTS (0xFFF)
+
+// block numbers are 12 bits wide, with 0, 1 and 0xFFF taken by the markers above
+#define MFS_MAX_ALLOC_BLOCKS (4094)
+
+struct __attribute__((packed)) mfs_dirent {
+    uint8_t flFlags;      // MFS_DIRENT_FLAGS_USED -> entry used; MFS_DIRENT_FLAGS_LOCKED -> file locked;
+    uint8_t flType;       // version number
+    uint8_t flUsrWds[16]; // finder stuff
+    uint32_t flFlNum;     // file number
+    uint16_t flStBlk;     // first allocation block of data fork
+    uint32_t flLgLen;     // logical file size (bytes)
+    uint32_t flPyLen;     // physical file size (bytes)
+    uint16_t flRStBlk;    // first allocation block of resource fork
+    uint32_t flRLgLen;    // logical resource size (bytes)
+    uint32_t flRPyLen;    // physical resource size (bytes)
+    uint32_t flCrDat;     // creation timestamp
+    uint32_t flMdDat;     // modification timestamp
+    uint8_t flNam;        // length of file name
+    // file name string follows - flNam + 1 bytes long
+};
+
+#define MFS_DIRENT_FLAGS_USED   (1 << 7)
+#define MFS_DIRENT_FLAGS_LOCKED (1 << 0)
+
+// decodes/encodes the on-disk big endian records, the volume and file names following them are not included
+typedef be_struct<mfs_mdb,
+                  MACTOOLS_BE_FIELD(mfs_mdb, drSigWord),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drCrDate),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drLsBkUp),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drAtrb),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drNmFls),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drDirSt),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drBlLen),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drNmAlBlks),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drAlBlkSiz),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drClpSiz),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drAlBiSt),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drNxtFNum),
+                  MACTOOLS_BE_FIELD(mfs_mdb, drFreeBks)>
+    mfs_mdb_codec;
+
+typedef be_struct<mfs_dirent,
+                  MACTOOLS_BE_FIELD(mfs_dirent, flFlNum),
+                  MACTOOLS_BE_FIELD(mfs_dirent, flStBlk),
+                  MACTOOLS_BE_FIELD(mfs_dirent, flLgLen),
+                  MACTOOLS_BE_FIELD(mfs_dirent, flPyLen),
+                  MACTOOLS_BE_FIELD(mfs_dirent, flRStBlk),
+                  MACTOOLS_BE_FIELD(mfs_dirent, flRLgLen),
+                  MACTOOLS_BE_FIELD(mfs_dirent, flRPyLen),
+                  MACTOOLS_BE_FIELD(mfs_dirent, flCrDat),
+                  MACTOOLS_BE_FIELD(mfs_dirent, flMdDat)>
+    mfs_dirent_codec;
+
+// returns false if the MDB fields are inconsistent, the signature is not checked
+bool mfs_mdb_valid(const struct mfs_mdb &mdb);
+
+// size of the packed allocation block map for count allocation blocks
+inline size_t mfs_alloc_block_map_size(size_t count) {
+    return ((count * 3) + 1) / 2;
+}
+
+// decodes the 12-bit map entry of allocation block index + 2 from the packed map
+inline uint16_t mfs_alloc_block_map_entry(const uint8_t *packed, size_t index) {
+    uint16_t value = load_be<uint16_t>(&packed[index + (index / 2)]); // * 1.5
+    return (index & 0x01) != 0 ? value & 0xFFF : value >> 4;
+}
+
+void mfs_unpack_alloc_block_map(const uint8_t *packed, size_t count, uint16_t *map);
+// packed has to be mfs_alloc_block_map_size(count) bytes long
+void mfs_pack_alloc_block_map(const uint16_t *map, size_t count, uint8_t *packed);
+
+// disk offset of an allocation block, relative to the start of the volume
+inline size_t mfs_alloc_block_offset(const struct mfs_mdb &mdb, uint16_t block) {
+    return ((size_t)mdb.drAlBiSt * MFS_SECTOR_SIZE) + (((size_t)block - 2) * mdb.drAlBlkSiz);
+}
+
+// decodes the directory entry at *offset in the raw directory blocks and advances *offset to the next one
+// returns false if there are no more entries, *name points to the dirent->flNam bytes long name (not null terminated)
+bool mfs_next_dirent(const uint8_t *directory, size_t directory_size, size_t *offset, struct mfs_dirent *dirent, const char **name);
+
+// true for entries that are in use and consistent enough to be read
+bool mfs_dirent_valid(const struct mfs_dirent &dirent);
+
+// name to use for an MFS file on the host: MFS names may contain anything but ':', so '/' becomes ':' and NUL '_'
+// ".", ".." and the empty name, which can't be host file names, become "_", "__" and "_"
+std::string mfs_host_filename(const char *name, size_t len);
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <mactools/mfs.h>
+
+class mount_cache;
+struct mount_cache_data;
+
+struct mfs_dir_entry {
+    struct mfs_dirent dirent; // already byte swapped
+    const char *name;         // points into mfs_driver_state::directory, dirent.flNam bytes long, not null terminated
+};
+
+// reads count bytes at offset into buf, disk is the opaque pointer passed to init_mfs_driver
+typedef void (*mfs_read_disk_fn)(void *disk, void *buf, size_t count, size_t offset);
+
+// hints that count bytes at offset will be read soon, optional
+typedef void (*mfs_prefetch_disk_fn)(void *disk, size_t count, size_t offset);
+
+// I/O counters, reset by init_mfs_driver
+struct mfs_io_stats {
+    uint64_t read_calls; // calls of the read callback
+    uint64_t bytes_read;
+    uint64_t seeks;      // reads that didn't start where the previous one ended
+    uint64_t chain_hops; // allocation block map lookups while building extent lists
+    size_t next_offset;  // where the previous read ended
+};
+
+struct mfs_driver_state {
+    mfs_read_disk_fn read_disk;
+    mfs_prefetch_disk_fn prefetch_disk; // nullptr unless set with mfs_set_prefetch
+    void *disk;
+    size_t disk_part_start;
+
+    struct mfs_mdb mdb;
+#ifndef MFSRO_NO_ALLOC_MAP_CACHE
+    uint16_t *alloc_map; // decoded allocation block map, entry n belongs to allocation block n + 2
+#endif
+
+    uint8_t *directory; // raw directory blocks, or just the file names if initialized from a mount cache
+    struct mfs_dir_entry *dir_entries;
+    uint16_t dir_entry_count;
+    uint16_t *dir_hash; // name index into dir_entries (index + 1, 0 -> empty slot)
+    uint32_t dir_hash_size;
+
+    struct mfs_io_stats stats;
+};
+
+// a run of contiguous allocation blocks belonging to a fork
+struct mfs_extent {
+    uint32_t file_offset; // offset of the run within the fork
+    uint16_t start_block; // first allocation block of the run
+    uint16_t block_count; // number of allocation blocks in the run
+};
+
+struct mfs_file_handle {
+    uint32_t seekpos;
+    bool resource_fork;
+    bool open;
+    struct mfs_dirent dirent;
+    struct mfs_extent *extents; // built by mfs_open_file, sorted by file_offset
+    uint16_t extent_count;
+};
+
+// returns nonzero value on error
+// the driver keeps no global state, so independent mfs_driver_state instances may be used from different threads
+int init_mfs_driver(struct mfs_driver_state *ctx, mfs_read_disk_fn read_disk, void *disk, size_t disk_part_start);
+
+// like init_mfs_driver, but takes the volume metadata from a mount cache instead of reading it from disk
+// the cache is copied and can be dropped afterwards
+int init_mfs_driver_cached(struct mfs_driver_state *ctx, mfs_read_disk_fn read_disk, void *disk, const mount_cache &cache);
+
+// fills in everything but the image identification of data for write_mount_cache, reads the volume name from disk
+void mfs_fill_mount_cache(struct mfs_driver_state *ctx, struct mount_cache_data &data);
+
+// frees everything allocated by init_mfs_driver, must also be called if init_mfs_driver failed
+void deinit_mfs_driver(struct mfs_driver_state *ctx);
+
+// sets the callback mfs_stream uses for read-ahead
+void mfs_set_prefetch(struct mfs_driver_state *ctx, mfs_prefetch_disk_fn prefetch_disk);
+
+// returns false on error
+bool mfs_open_file(struct mfs_driver_state *ctx, struct mfs_file_handle *file, const char *path, bool resource_fork = false);
+
+// frees everything allocated by mfs_open_file
+void mfs_close_file(struct mfs_driver_state *ctx, struct mfs_file_handle *file);
+
+#define MFS_SEEK_CURRENT (0x01)
+#define MFS_SEEK_BEGIN   (0x02)
+#define MFS_SEEK_END     (0x04)
+uint32_t mfs_seek(struct mfs_driver_state *ctx, struct mfs_file_handle *file, int32_t pos, uint8_t flags = MFS_SEEK_CURRENT);
+
+uint32_t mfs_read(struct mfs_driver_state *ctx, struct mfs_file_handle *file, void *buf, uint32_t count);
+
+// reads up to count bytes at offset without using or moving the seek position, returns the amount of bytes read
+// the handle is only read, so several threads may share one as long as the read callback is thread-safe
+uint32_t mfs_pread(struct mfs_driver_state *ctx, struct mfs_file_handle *file, void *buf, uint32_t count, uint32_t offset);
+
+struct mfs_read_range {
+    uint32_t offset;
+    uint32_t count;
+    void *buf;
+    uint32_t done; // set by mfs_preadv, less than count if the range reaches past the end of the file
+};
+
+// reads many ranges at once like mfs_pread, with the same thread safety
+// the ranges are mapped to disk first, pieces that touch or overlap on disk are read with a single call of the read callback
+// returns the amount of bytes read over all ranges
+size_t mfs_preadv(struct mfs_driver_state *ctx, struct mfs_file_handle *file, struct mfs_read_range *ranges, size_t range_count);
+
+// finds where byte pos of the file is stored, for handing contiguous runs to something that can copy them without going through mfs_read
+// returns the amount of bytes stored contiguously at *disk_offset (disk_part_start included), 0 past the end of the file
+uint32_t mfs_map(struct mfs_driver_state *ctx, struct mfs_file_handle *file, uint32_t pos, size_t *disk_offset);
+
+// called by mfs_stream for every chunk, return false to stop
+typedef bool (*mfs_stream_fn)(void *user, const void *data, uint32_t size);
+
+// reads the file from the current seek position to its end in chunks of up to chunk_size bytes into buf and hands each one to fn
+// the disk ranges of the next readahead chunks are passed to the prefetch callback (if set) before a chunk is read
+// memory use is just buf, no matter how large the file is; returns the amount of bytes handed to fn
+uint32_t mfs_stream(struct mfs_driver_state *ctx,
+                    struct mfs_file_handle *file,
+                    void *buf,
+                    uint32_t chunk_size,
+                    uint32_t readahead,
+                    mfs_stream_fn fn,
+                    void *user);
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mactools/image.h>
+#include <mactools/mfs.h>
+#include <mactools/mfsro.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// persistent cache of the decoded metadata of a volume, for tools that open the same images over and over:
+// MDB, unpacked allocation block map, directory entries and the extents of every fork, so a warm start maps one small
+// file instead of reading and checking the image
+// a cache file belongs to the absolute path, size and mtime of an image and carries a hash of its contents, anything
+// that doesn't match is a miss; files are in host byte order, a cache from another architecture is a miss as well
+
+#define MOUNT_CACHE_MAGIC      "MFSMOUNT"
+#define MOUNT_CACHE_VERSION    (1)
+#define MOUNT_CACHE_BYTE_ORDER (0x01020304)
+
+struct mount_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t image_size;
+    int64_t image_mtime_ns;
+    uint64_t payload_hash;    // XXH64 of everything after the header
+    uint64_t disk_part_start; // where the volume starts in the image file, DC42_HEADER_SIZE for DiskCopy 4.2 images
+    uint32_t path_length;
+    uint32_t file_count;
+    uint32_t extent_count;
+    uint32_t names_size;
+    struct mfs_mdb mdb; // decoded
+    char volume_name[MFS_VOLUME_NAME_MAX];
+    // followed by the image path, the allocation block map (mdb.drNmAlBlks entries), the file table, the extents and the
+    // file names, each table starting 8-byte aligned
+};
+
+struct mount_cache_file {
+    struct mfs_dirent dirent; // decoded
+    uint8_t reserved;
+    uint32_t name_offset;     // into the names, dirent.flNam bytes long
+    uint32_t first_extent;    // data fork extents followed by resource fork extents
+    uint16_t extent_count[2]; // data and resource fork
+};
+
+// everything that goes into a cache file
+struct mount_cache_data {
+    // identify the image, filled in by mount_cache_stat before the image is read
+    std::string image_path;
+    uint64_t image_size;
+    int64_t image_mtime_ns;
+
+    size_t disk_part_start;
+    struct mfs_mdb mdb;
+    std::string volume_name;
+    std::vector<uint16_t> alloc_map; // entry n belongs to allocation block n + 2
+    std::vector<struct mount_cache_file> files;
+    std::vector<struct mfs_extent> extents;
+    std::string names;
+};
+
+// read-only view of a cache file, all pointers stay valid for the lifetime of the instance
+class mount_cache {
+public:
+    size_t disk_part_start() const;
+    const struct mfs_mdb &mdb() const;
+    std::string volume_name() const;
+    const uint16_t *alloc_map() const; // mdb().drNmAlBlks entries
+
+    size_t file_count() const;
+    const struct mount_cache_file &file(size_t index) const;
+    const char *name(size_t index) const; // file(index).dirent.flNam bytes long, not null terminated
+    const struct mfs_extent *extents(size_t index, bool resource_fork) const;
+
+private:
+    friend std::shared_ptr<mount_cache> open_mount_cache(const std::string &path, const std::string &image_path);
+
+    std::shared_ptr<image> _file;
+    const struct mount_cache_header *_header;
+    const uint16_t *_alloc_map;
+    const struct mount_cache_file *_files;
+    const struct mfs_extent *_extents;
+    const char *_names;
+};
+
+// name of the cache file for an image in cache_dir, derived from the absolute image path
+std::string mount_cache_path(const std::string &cache_dir, const std::string &image_path);
+
+// returns nullptr if there is no cache file at path or it doesn't belong to the image as it is now
+std::shared_ptr<mount_cache> open_mount_cache(const std::string &path, const std::string &image_path);
+
+// fills in the image path, size and mtime of data, returns false if the image can't be found
+// has to be called before the image is read, so a change while it is read makes the cache file stale instead of wrong
+bool mount_cache_stat(const std::string &image_path, struct mount_cache_data &data);
+
+// writes a cache file through a temporary file that replaces path once complete, returns false (with errno set) on errors
+bool write_mount_cache(const std::string &path, const struct mount_cache_data &data);
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mactools/image.h>
+#include <mactools/mfsro.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// docs: Inside Macintosh I pages 128-131
+
+#define RESOURCE_CACHE_DEFAULT_SIZE (256 * 1024)
+
+// four character codes like 'CODE' as big endian integers
+#define RESOURCE_TYPE(a, b, c, d) (((uint32_t)(uint8_t)(a) << 24) | ((uint32_t)(uint8_t)(b) << 16) | ((uint32_t)(uint8_t)(c) << 8) | (uint8_t)(d))
+
+// reads up to count bytes at offset of the fork into buf, returns the amount of bytes read
+typedef std::function<size_t(void *buf, size_t count, size_t offset)> resource_read_fn;
+
+// random access to the resources in a resource fork without reading all of it
+// only the header and the resource map are read up front, resource data is read on request and the most recently used
+// resources are kept in memory up to a byte budget; not thread safe
+class resource_fork {
+public:
+    struct resource_info {
+        uint32_t type;
+        int16_t id;
+        uint8_t attributes;
+        std::string name; // empty if the resource has none
+    };
+
+    // throws std::runtime_error if the fork is empty or its header or map are invalid
+    resource_fork(resource_read_fn read, size_t fork_size, size_t cache_size = RESOURCE_CACHE_DEFAULT_SIZE);
+    // reads through the driver, file has to be a resource fork opened with mfs_open_file and stay open for the lifetime of this
+    resource_fork(struct mfs_driver_state *ctx, struct mfs_file_handle *file, size_t cache_size = RESOURCE_CACHE_DEFAULT_SIZE);
+
+    // resource types in the order of the map
+    std::vector<uint32_t> types() const;
+    // resources of one type, sorted by ID
+    std::vector<struct resource_info> list(uint32_t type) const;
+    bool contains(uint32_t type, int16_t id) const;
+    // returns the data of a resource, nullptr if there is no such resource
+    // throws std::runtime_error if its data lies outside of the fork
+    std::shared_ptr<const std::vector<uint8_t>> get(uint32_t type, int16_t id);
+
+    // hits and misses of get(), evictions from the cache
+    const struct cache_stats &stats() const;
+
+private:
+    struct resource_ref {
+        uint32_t type;
+        int16_t id;
+        uint8_t attributes;
+        uint16_t name_offset; // into the name list, 0xFFFF -> no name
+        uint32_t data_offset; // into the data section, points to the length
+    };
+
+    void load_map();
+    const struct resource_ref *find(uint32_t type, int16_t id) const;
+    struct resource_info info(const struct resource_ref &ref) const;
+    void read_exact(void *buf, size_t count, size_t offset);
+
+    resource_read_fn _read;
+    size_t _fork_size;
+    uint32_t _data_offset;
+    uint32_t _data_size;
+    std::vector<uint8_t> _map;
+    uint16_t _name_list_offset;             // into _map
+    std::vector<uint32_t> _types;           // map order
+    std::vector<struct resource_ref> _refs; // sorted by type and ID
+
+    typedef uint64_t cache_key; // type and ID
+    struct cache_entry {
+        std::shared_ptr<const std::vector<uint8_t>> data;
+        std::list<cache_key>::iterator lru; // position in _lru
+    };
+    size_t _cache_size;
+    size_t _cached_bytes;
+    std::unordered_map<cache_key, struct cache_entry> _cache;
+    std::list<cache_key> _lru; // most recently used first
+    struct cache_stats _stats;
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// I/O counters of a volume, summed over everything read through it
+struct io_stats {
+    uint64_t read_calls;
+    uint64_t bytes_read;
+    uint64_t seeks;        // reads that didn't start where the previous one ended
+    uint64_t chain_hops;   // allocation block map lookups while following allocation chains
+    uint64_t cache_hits;   // only counted if the volume is read through a cached_image
+    uint64_t cache_misses;
+};
+
+void add_io_stats(struct io_stats &sum, const struct io_stats &stats);
+
+// collects timed phases (mount, directory scan, extraction, ...) from any thread
+// can be written as Chrome trace event JSON, which chrome://tracing and Perfetto load
+class trace_log {
+public:
+    trace_log();
+
+    // records a phase that started at start and ends now
+    void add(const char *name, std::chrono::steady_clock::time_point start);
+    // total milliseconds spent per phase name, in order of first appearance
+    std::vector<std::pair<std::string, double>> totals() const;
+    // returns false if the file couldn't be written
+    bool write_chrome_trace(const char *path) const;
+
+private:
+    struct event {
+        std::string name;
+        uint64_t start; // microseconds since the log was created
+        uint64_t duration;
+        uint64_t thread;
+    };
+
+    std::chrono::steady_clock::time_point _epoch;
+    mutable std::mutex _lock;
+    std::vector<struct event> _events;
+};
+
+// records its own lifetime as a phase, does nothing if log is nullptr
+class trace_span {
+public:
+    trace_span(trace_log *log, const char *name);
+    ~trace_span();
+
+private:
+    trace_log *_log;
+    const char *_name;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// the --stats output of the tools, the I/O line is left out if nothing was counted; log may be nullptr
+void print_stats(FILE *out, const struct io_stats &stats, const trace_log *log);
@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mactools/diskcopy42.h>
+#include <mactools/image.h>
+#include <mactools/mactools.h>
+#include <mactools/mfsro.h>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+
+struct mactools_volume {
+    std::shared_ptr<image> img;
+    struct mfs_driver_state state;
+    bool mounted;
+    std::string name;
+    std::unordered_set<mactools_file *> files;
+};
+
+struct mactools_file {
+    mactools_volume *volume;
+    struct mfs_file_handle handle;
+    uint32_t size;
+};
+
+static void read_image(void *disk, void *buf, size_t count, size_t offset) {
+    ((image *)disk)->read(buf, count, offset);
+}
+
+static void prefetch_image(void *disk, size_t count, size_t offset) {
+    ((image *)disk)->prefetch(offset, count);
+}
+
+// the driver reports read errors by letting the image's exceptions through, they must not cross the C boundary
+static int mount(std::shared_ptr<image> img, unsigned flags, mactools_volume **volume) {
+    std::unique_ptr<mactools_volume> ret(new mactools_volume());
+    ret->img = img;
+    ret->mounted = false;
+    try {
+        size_t disk_part_start = 0;
+        struct dc42_info dc42;
+        if (dc42_probe(*img, &dc42)) {
+            if (((flags & MACTOOLS_MOUNT_VERIFY) != 0) && (!dc42_verify_data(*img, dc42) || !dc42_verify_tags(*img, dc42))) {
+                return MACTOOLS_ERR_CHECKSUM;
+            }
+            disk_part_start = DC42_HEADER_SIZE;
+        }
+
+        // init_mfs_driver clears all pointers before it reads anything, deinit_mfs_driver is safe even if it throws
+        ret->mounted = true;
+        int err = init_mfs_driver(&ret->state, read_image, img.get(), disk_part_start);
+        if (err != 0) {
+            deinit_mfs_driver(&ret->state);
+            return MACTOOLS_ERR_FORMAT;
+        }
+        mfs_set_prefetch(&ret->state, prefetch_image);
+
+        const uint8_t *name = img->view(disk_part_start + MFS_MDB_OFFSET + sizeof(struct mfs_mdb), MFS_VOLUME_NAME_MAX);
+        ret->name.assign((const char *)name, std::min(ret->state.mdb.drVN, (uint8_t)MFS_VOLUME_NAME_MAX));
+    } catch (const std::bad_alloc &) {
+        if (ret->mounted) {
+            deinit_mfs_driver(&ret->state);
+        }
+        return MACTOOLS_ERR_NO_MEMORY;
+    } catch (const std::exception &) {
+        if (ret->mounted) {
+            deinit_mfs_driver(&ret->state);
+        }
+        // reads past the end of the image, the MDB points outside of it
+        return MACTOOLS_ERR_FORMAT;
+    }
+    *volume = ret.release();
+    return MACTOOLS_OK;
+}
+
+int mactools_abi_version(void) {
+    return MACTOOLS_ABI_VERSION;
+}
+
+const char *mactools_strerror(int err) {
+    switch (err) {
+    case MACTOOLS_OK:
+        return "success";
+    case MACTOOLS_ERR_IO:
+        return "I/O error";
+    case MACTOOLS_ERR_FORMAT:
+        return "not a valid MFS volume";
+    case MACTOOLS_ERR_CHECKSUM:
+        return "DiskCopy 4.2 checksum invalid";
+    case MACTOOLS_ERR_NOT_FOUND:
+        return "not found";
+    case MACTOOLS_ERR_INVALID:
+        return "invalid argument";
+    case MACTOOLS_ERR_NO_MEMORY:
+        return "out of memory";
+    default:
+        return "unknown error";
+    }
+}
+
+int mactools_mount_file(const char *path, unsigned flags, mactools_volume **volume) {
+    if ((path == nullptr) || (volume == nullptr)) {
+        return MACTOOLS_ERR_INVALID;
+    }
+    try {
+        std::shared_ptr<image> img = open_image(path);
+        if (img == nullptr) {
+            return MACTOOLS_ERR_IO;
+        }
+        return mount(img, flags, volume);
+    } catch (const std::bad_alloc &) {
+        return MACTOOLS_ERR_NO_MEMORY;
+    } catch (const std::exception &) {
+        return MACTOOLS_ERR_IO;
+    }
+}
+
+int mactools_mount_memory(const void *data, size_t size, unsigned flags, mactools_volume **volume) {
+    if ((data == nullptr) || (volume == nullptr)) {
+        return MACTOOLS_ERR_INVALID;
+    }
+    try {
+        return mount(std::make_shared<memory_image>((const uint8_t *)data, size), flags, volume);
+    } catch (const std::bad_alloc &) {
+        return MACTOOLS_ERR_NO_MEMORY;
+    }
+}
+
+void mactools_unmount(mactools_volume *volume) {
+    if (volume == nullptr) {
+        return;
+    }
+    for (mactools_file *file : volume->files) {
+        mfs_close_file(&volume->state, &file->handle);
+        delete file;
+    }
+    deinit_mfs_driver(&volume->state);
+    delete volume;
+}
+
+const char *mactools_volume_name(const mactools_volume *volume) {
+    return volume->name.c_str();
+}
+
+size_t mactools_file_count(const mactools_volume *volume) {
+    return volume->state.dir_entry_count;
+}
+
+int mactools_readdir(const mactools_volume *volume, size_t index, mactools_dirent *entry) {
+    if (entry == nullptr) {
+        return MACTOOLS_ERR_INVALID;
+    }
+    if (index >= volume->state.dir_entry_count) {
+        return MACTOOLS_ERR_NOT_FOUND;
+    }
+    const struct mfs_dir_entry &e = volume->state.dir_entries[index];
+    memcpy(entry->name, e.name, e.dirent.flNam);
+    entry->name[e.dirent.flNam] = '\0';
+    entry->file_number = e.dirent.flFlNum;
+    entry->data_size = e.dirent.flLgLen;
+    entry->rsrc_size = e.dirent.flRLgLen;
+    entry->create_date = e.dirent.flCrDat;
+    entry->modify_date = e.dirent.flMdDat;
+    memcpy(entry->finder_info, e.dirent.flUsrWds, sizeof(entry->finder_info));
+    entry->flags = (e.dirent.flFlags & MFS_DIRENT_FLAGS_LOCKED) != 0 ? MACTOOLS_FILE_LOCKED : 0;
+    return MACTOOLS_OK;
+}
+
+int mactools_open(mactools_volume *volume, const char *name, int fork, mactools_file **file) {
+    if ((name == nullptr) || (file == nullptr) || ((fork != MACTOOLS_FORK_DATA) && (fork != MACTOOLS_FORK_RESOURCE))) {
+        return MACTOOLS_ERR_INVALID;
+    }
+    try {
+        std::unique_ptr<mactools_file> ret(new mactools_file());
+        ret->volume = volume;
+        if (!mfs_open_file(&volume->state, &ret->handle, name, fork == MACTOOLS_FORK_RESOURCE)) {
+            return MACTOOLS_ERR_NOT_FOUND;
+        }
+        ret->size = mfs_seek(&volume->state, &ret->handle, 0, MFS_SEEK_END);
+        volume->files.insert(ret.get());
+        *file = ret.release();
+        return MACTOOLS_OK;
+    } catch (const std::bad_alloc &) {
+        return MACTOOLS_ERR_NO_MEMORY;
+    } catch (const std::exception &) {
+        return MACTOOLS_ERR_IO;
+    }
+}
+
+uint64_t mactools_file_size(const mactools_file *file) {
+    return file->size;
+}
+
+int64_t mactools_read(mactools_file *file, void *buf, size_t count, uint64_t offset) {
+    if ((buf == nullptr) && (count != 0)) {
+        return MACTOOLS_ERR_INVALID;
+    }
+    if (offset >= file->size) {
+        return 0;
+    }
+    count = std::min(count, (size_t)(file->size - offset));
+    try {
+        uint32_t n = mfs_pread(&file->volume->state, &file->handle, buf, (uint32_t)count, (uint32_t)offset);
+        if ((n == 0) && (count != 0)) {
+            // the allocation chain ends before the logical size
+            return MACTOOLS_ERR_FORMAT;
+        }
+        return n;
+    } catch (const std::exception &) {
+        errno = EIO;
+        return MACTOOLS_ERR_IO;
+    }
+}
+
+void mactools_close(mactools_file *file) {
+    if (file == nullptr) {
+        return;
+    }
+    file->volume->files.erase(file);
+    mfs_close_file(&file->volume->state, &file->handle);
+    delete file;
+}
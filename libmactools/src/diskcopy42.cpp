@@ -0,0 +1,192 @@
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mactools/diskcopy42.h>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// checksums are calculated in chunks so stream backed images don't have to be read into memory at once, must be even
+#define CHKSUM_CHUNK_SIZE (512 * 20)
+
+bool dc42_probe(image &img, struct dc42_info *info) {
+    if (img.size() < DC42_HEADER_SIZE) {
+        return false;
+    }
+    struct dc42_header header = dc42_header_codec::decode(img.view(0, DC42_HEADER_SIZE));
+    if (header.magic != DC42_HEADER_MAGIC) {
+        return false;
+    }
+    struct dc42_info ret = {header.data_size, header.tag_size, header.data_chksum, header.tag_chksum};
+    if ((ret.data_size + ret.tag_size + DC42_HEADER_SIZE) != img.size()) {
+        return false;
+    }
+    if (info != nullptr) {
+        *info = ret;
+    }
+    return true;
+}
+
+static inline uint32_t chksum_step(uint32_t sum, uint16_t word) {
+    sum += word;
+    return (sum >> 1) | (sum << 31);
+}
+
+uint32_t dc42_checksum_update(uint32_t sum, const uint8_t *data, size_t words) {
+    size_t i = 0;
+    for (; (i + 4) <= words; i += 4) {
+        const uint8_t *p = &data[i * 2];
+        uint64_t v = load_be<uint64_t>(p);
+        sum = chksum_step(sum, (uint16_t)(v >> 48));
+        sum = chksum_step(sum, (uint16_t)(v >> 32));
+        sum = chksum_step(sum, (uint16_t)(v >> 16));
+        sum = chksum_step(sum, (uint16_t)v);
+    }
+    for (; i < words; i++) {
+        sum = chksum_step(sum, ((uint16_t)data[i * 2] << 8) | data[(i * 2) + 1]);
+    }
+    return sum;
+}
+
+uint32_t dc42_checksum(image &img, size_t offset, size_t bytes) {
+    uint32_t sum = 0;
+    bytes &= ~(size_t)1;
+    while (bytes != 0) {
+        size_t chunksize = bytes > CHKSUM_CHUNK_SIZE ? CHKSUM_CHUNK_SIZE : bytes;
+        sum = dc42_checksum_update(sum, img.view(offset, chunksize), chunksize / 2);
+        offset += chunksize;
+        bytes -= chunksize;
+    }
+    return sum;
+}
+
+bool dc42_verify_data(image &img, const struct dc42_info &info) {
+    return dc42_checksum(img, DC42_HEADER_SIZE, info.data_size) == info.data_chksum;
+}
+
+bool dc42_verify_tags(image &img, const struct dc42_info &info) {
+    // the first 12 bytes of the tag section are skipped due to a bug in an old Apple DiskCopy version
+    if (info.tag_size <= 12) {
+        return true;
+    }
+    return dc42_checksum(img, DC42_HEADER_SIZE + info.data_size + 12, info.tag_size - 12) == info.tag_chksum;
+}
+
+struct copy_slot {
+    std::vector<uint8_t> buf; // only used if the image can't hand out persistent views
+    const uint8_t *data;
+    size_t offset;
+    size_t size;
+};
+
+uint32_t dc42_copy_checksum(image &in, size_t offset, int out_fd, size_t bytes, size_t bufsize) {
+    struct copy_slot slots[2];
+    std::deque<struct copy_slot *> free_slots = {&slots[0], &slots[1]};
+    std::deque<struct copy_slot *> full_slots;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool reader_done = false;
+    bool abort = false;
+    std::exception_ptr reader_error;
+    uint32_t sum = 0;
+
+    std::thread reader([&]() {
+        try {
+            while (bytes != 0) {
+                struct copy_slot *slot;
+                {
+                    std::unique_lock<std::mutex> l(lock);
+                    cv.wait(l, [&]() { return !free_slots.empty() || abort; });
+                    if (abort) {
+                        break;
+                    }
+                    slot = free_slots.front();
+                    free_slots.pop_front();
+                }
+                slot->offset = offset;
+                slot->size = bytes > bufsize ? bufsize : bytes;
+                if (in.persistent_views()) {
+                    slot->data = in.view(offset, slot->size);
+                } else {
+                    slot->buf.resize(bufsize);
+                    in.read(slot->buf.data(), slot->size, offset);
+                    slot->data = slot->buf.data();
+                }
+                sum = dc42_checksum_update(sum, slot->data, slot->size / 2);
+                offset += slot->size;
+                bytes -= slot->size;
+                {
+                    std::lock_guard<std::mutex> l(lock);
+                    full_slots.push_back(slot);
+                }
+                cv.notify_all();
+            }
+        } catch (...) {
+            reader_error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> l(lock);
+            reader_done = true;
+        }
+        cv.notify_all();
+    });
+
+    std::exception_ptr writer_error;
+    while (true) {
+        struct copy_slot *slot;
+        {
+            std::unique_lock<std::mutex> l(lock);
+            cv.wait(l, [&]() { return !full_slots.empty() || reader_done; });
+            if (full_slots.empty()) {
+                break;
+            }
+            slot = full_slots.front();
+            full_slots.pop_front();
+        }
+        try {
+            if (in.persistent_views()) {
+                copy_image_range(in, slot->offset, slot->size, out_fd);
+            } else {
+                write_all(out_fd, slot->data, slot->size);
+            }
+        } catch (...) {
+            writer_error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> l(lock);
+            abort = writer_error != nullptr;
+            free_slots.push_back(slot);
+        }
+        cv.notify_all();
+        if (writer_error) {
+            break;
+        }
+    }
+    reader.join();
+    if (writer_error) {
+        std::rethrow_exception(writer_error);
+    }
+    if (reader_error) {
+        std::rethrow_exception(reader_error);
+    }
+    return sum;
+}
+
+void dc42_update_data_checksum(image &img, struct dc42_info &info) {
+    info.data_chksum = dc42_checksum(img, DC42_HEADER_SIZE, info.data_size);
+    uint8_t raw[4];
+    store_be<uint32_t>(raw, info.data_chksum);
+    img.write(raw, sizeof(raw), offsetof(struct dc42_header, data_chksum));
+}
+
+std::shared_ptr<image> dc42_unwrap(std::shared_ptr<image> img, bool verify) {
+    struct dc42_info info;
+    if (!dc42_probe(*img.get(), &info)) {
+        return img;
+    }
+    if (verify && (!dc42_verify_data(*img.get(), info) || !dc42_verify_tags(*img.get(), info))) {
+        throw std::runtime_error("DiskCopy 4.2 checksum invalid");
+    }
+    return std::make_shared<slice_image>(img, DC42_HEADER_SIZE, info.data_size);
+}
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cstring>
+#include <mactools/endian.h>
+#include <mactools/hash.h>
+
+#define XXH_PRIME64_1 (0x9E3779B185EBCA87ull)
+#define XXH_PRIME64_2 (0xC2B2AE3D27D4EB4Full)
+#define XXH_PRIME64_3 (0x165667B19E3779F9ull)
+#define XXH_PRIME64_4 (0x85EBCA77C2B2AE63ull)
+#define XXH_PRIME64_5 (0x27D4EB2F165667C5ull)
+
+#define XXH_STRIPE_SIZE (32)
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    return rotl64(acc, 31) * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return (acc * XXH_PRIME64_1) + XXH_PRIME64_4;
+}
+
+// four independent lanes, so the multiplies of a stripe overlap
+static inline void xxh_stripe(uint64_t *acc, const uint8_t *p) {
+    acc[0] = xxh_round(acc[0], load_le<uint64_t>(p));
+    acc[1] = xxh_round(acc[1], load_le<uint64_t>(p + 8));
+    acc[2] = xxh_round(acc[2], load_le<uint64_t>(p + 16));
+    acc[3] = xxh_round(acc[3], load_le<uint64_t>(p + 24));
+}
+
+xxh64::xxh64(uint64_t seed) {
+    _seed = seed;
+    _acc[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    _acc[1] = seed + XXH_PRIME64_2;
+    _acc[2] = seed;
+    _acc[3] = seed - XXH_PRIME64_1;
+    _total = 0;
+    _buffered = 0;
+}
+
+void xxh64::update(const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+    _total += size;
+    if (_buffered != 0) {
+        size_t amount = std::min(size, (size_t)XXH_STRIPE_SIZE - _buffered);
+        memcpy(&_buf[_buffered], p, amount);
+        _buffered += amount;
+        p += amount;
+        size -= amount;
+        if (_buffered != XXH_STRIPE_SIZE) {
+            return;
+        }
+        xxh_stripe(_acc, _buf);
+        _buffered = 0;
+    }
+    for (; size >= XXH_STRIPE_SIZE; p += XXH_STRIPE_SIZE, size -= XXH_STRIPE_SIZE) {
+        xxh_stripe(_acc, p);
+    }
+    memcpy(_buf, p, size);
+    _buffered = size;
+}
+
+uint64_t xxh64::digest() const {
+    uint64_t h;
+    if (_total >= XXH_STRIPE_SIZE) {
+        h = rotl64(_acc[0], 1) + rotl64(_acc[1], 7) + rotl64(_acc[2], 12) + rotl64(_acc[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = xxh_merge_round(h, _acc[i]);
+        }
+    } else {
+        h = _seed + XXH_PRIME64_5;
+    }
+    h += _total;
+
+    const uint8_t *p = _buf;
+    size_t remaining = _buffered;
+    for (; remaining >= 8; p += 8, remaining -= 8) {
+        h ^= xxh_round(0, load_le<uint64_t>(p));
+        h = (rotl64(h, 27) * XXH_PRIME64_1) + XXH_PRIME64_4;
+    }
+    if (remaining >= 4) {
+        h ^= (uint64_t)load_le<uint32_t>(p) * XXH_PRIME64_1;
+        h = (rotl64(h, 23) * XXH_PRIME64_2) + XXH_PRIME64_3;
+        p += 4;
+        remaining -= 4;
+    }
+    for (; remaining > 0; p++, remaining--) {
+        h ^= *p * XXH_PRIME64_5;
+        h = rotl64(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <mactools/image.h>
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define SECTOR_SIZE (512)
+
+// chunk size for copies that have to go through userspace
+#define COPY_CHUNK_SIZE (1024 * 1024)
+
+static void check_range(size_t image_size, size_t offset, size_t count) {
+    if ((offset > image_size) || (count > (image_size - offset))) {
+        throw std::runtime_error("read outside of image");
+    }
+}
+
+void image::write(const void *buf, size_t count, size_t offset) {
+    throw std::runtime_error("image is read-only");
+}
+
+void image::read(void *buf, size_t count, size_t offset) {
+    if (count == 0) {
+        return;
+    }
+    memcpy(buf, view(offset, count), count);
+}
+
+mmap_image::mmap_image(const uint8_t *data, size_t size, int fd, bool writable) {
+    _data = data;
+    _size = size;
+    _fd = fd;
+    _writable = writable;
+}
+
+mmap_image::~mmap_image() {
+#ifdef HAVE_MMAP
+    munmap((void *)_data, _size);
+    close(_fd);
+#endif
+}
+
+size_t mmap_image::size() const {
+    return _size;
+}
+
+const uint8_t *mmap_image::view(size_t offset, size_t count) {
+    check_range(_size, offset, count);
+    return _data + offset;
+}
+
+bool mmap_image::persistent_views() const {
+    return true;
+}
+
+int mmap_image::backing_fd(size_t &offset) const {
+    return _fd;
+}
+
+void mmap_image::prefetch(size_t offset, size_t count) {
+#ifdef HAVE_MMAP
+    if ((offset >= _size) || (count == 0)) {
+        return;
+    }
+    count = std::min(count, _size - offset);
+    // madvise wants a page aligned start address
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset - (offset % page_size);
+    madvise((void *)(_data + start), count + (offset - start), MADV_WILLNEED);
+#endif
+}
+
+bool mmap_image::writable() const {
+    return _writable;
+}
+
+void mmap_image::write(const void *buf, size_t count, size_t offset) {
+    if (!_writable) {
+        image::write(buf, count, offset);
+    }
+    check_range(_size, offset, count);
+#ifdef HAVE_MMAP
+    // the mapping is shared, so it sees everything written to the file
+    const uint8_t *p = (const uint8_t *)buf;
+    while (count != 0) {
+        ssize_t n = pwrite(_fd, p, count, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("failed to write image (") + std::strerror(errno) + ")");
+        }
+        p += n;
+        offset += (size_t)n;
+        count -= (size_t)n;
+    }
+#endif
+}
+
+memory_image::memory_image(const uint8_t *data, size_t size) {
+    _data = data;
+    _size = size;
+}
+
+size_t memory_image::size() const {
+    return _size;
+}
+
+const uint8_t *memory_image::view(size_t offset, size_t count) {
+    check_range(_size, offset, count);
+    return _data + offset;
+}
+
+bool memory_image::persistent_views() const {
+    return true;
+}
+
+stream_image::stream_image(std::shared_ptr<std::iostream> stream) {
+    _stream = stream;
+    _stream.get()->seekg(0, std::ios_base::end);
+    _size = (size_t)_stream.get()->tellg();
+}
+
+size_t stream_image::size() const {
+    return _size;
+}
+
+const uint8_t *stream_image::view(size_t offset, size_t count) {
+    check_range(_size, offset, count);
+    if (_buf.size() < count) {
+        _buf.resize(count);
+    }
+    _stream.get()->seekg(offset, std::ios_base::beg);
+    _stream.get()->read((char *)_buf.data(), count);
+    if (!_stream.get()->good()) {
+        throw std::runtime_error("failed to read from input stream");
+    }
+    return _buf.data();
+}
+
+bool stream_image::persistent_views() const {
+    return false;
+}
+
+bool stream_image::writable() const {
+    return true;
+}
+
+void stream_image::write(const void *buf, size_t count, size_t offset) {
+    check_range(_size, offset, count);
+    _stream.get()->seekp(offset, std::ios_base::beg);
+    _stream.get()->write((const char *)buf, count);
+    if (!_stream.get()->good()) {
+        throw std::runtime_error("failed to write to image stream");
+    }
+}
+
+slice_image::slice_image(std::shared_ptr<image> parent, size_t offset, size_t size) {
+    check_range(parent.get()->size(), offset, size);
+    _parent = parent;
+    _offset = offset;
+    _size = size;
+}
+
+size_t slice_image::size() const {
+    return _size;
+}
+
+const uint8_t *slice_image::view(size_t offset, size_t count) {
+    check_range(_size, offset, count);
+    return _parent.get()->view(_offset + offset, count);
+}
+
+bool slice_image::persistent_views() const {
+    return _parent.get()->persistent_views();
+}
+
+void slice_image::prefetch(size_t offset, size_t count) {
+    if (offset < _size) {
+        _parent.get()->prefetch(_offset + offset, std::min(count, _size - offset));
+    }
+}
+
+bool slice_image::writable() const {
+    return _parent.get()->writable();
+}
+
+void slice_image::write(const void *buf, size_t count, size_t offset) {
+    check_range(_size, offset, count);
+    _parent.get()->write(buf, count, _offset + offset);
+}
+
+int slice_image::backing_fd(size_t &offset) const {
+    offset += _offset;
+    return _parent.get()->backing_fd(offset);
+}
+
+cached_image::cached_image(std::shared_ptr<image> parent, size_t page_size, size_t page_count, enum cache_policy policy) {
+    if ((page_size == 0) || ((page_size % SECTOR_SIZE) != 0)) {
+        throw std::runtime_error("cache page size must be a multiple of the sector size");
+    }
+    _parent = parent;
+    _page_size = page_size;
+    _policy = policy;
+    _slots.resize(std::max(page_count, (size_t)1));
+    for (size_t i = 0; i < _slots.size(); i++) {
+        _slots[i].index = SIZE_MAX;
+        _slots[i].referenced = false;
+        _slots[i].lru = _lru.insert(_lru.end(), i);
+    }
+    _hand = 0;
+    _stats = {0, 0, 0};
+}
+
+size_t cached_image::size() const {
+    return _parent.get()->size();
+}
+
+size_t cached_image::victim() {
+    if (_policy == CACHE_LRU) {
+        return _lru.back();
+    }
+    // clear referenced bits until a slot without one comes around
+    while (_slots[_hand].referenced) {
+        _slots[_hand].referenced = false;
+        _hand = (_hand + 1) % _slots.size();
+    }
+    size_t ret = _hand;
+    _hand = (_hand + 1) % _slots.size();
+    return ret;
+}
+
+const uint8_t *cached_image::page(size_t index) {
+    size_t slot;
+    auto it = _index.find(index);
+    if (it != _index.end()) {
+        _stats.hits++;
+        slot = it->second;
+    } else {
+        _stats.misses++;
+        slot = victim();
+        struct cache_slot &s = _slots[slot];
+        if (s.index != SIZE_MAX) {
+            _stats.evictions++;
+            _index.erase(s.index);
+            s.index = SIZE_MAX;
+        }
+        size_t offset = index * _page_size;
+        s.data.resize(std::min(_page_size, size() - offset));
+        _parent.get()->read(s.data.data(), s.data.size(), offset);
+        s.index = index;
+        _index[index] = slot;
+    }
+    if (_policy == CACHE_LRU) {
+        _lru.splice(_lru.begin(), _lru, _slots[slot].lru);
+    } else {
+        _slots[slot].referenced = true;
+    }
+    return _slots[slot].data.data();
+}
+
+const uint8_t *cached_image::view(size_t offset, size_t count) {
+    check_range(size(), offset, count);
+    if (count == 0) {
+        return _buf.data();
+    }
+    size_t first = offset / _page_size;
+    if (((offset + count - 1) / _page_size) == first) {
+        return page(first) + (offset % _page_size);
+    }
+    if (_buf.size() < count) {
+        _buf.resize(count);
+    }
+    size_t done = 0;
+    while (done != count) {
+        size_t page_offset = (offset + done) % _page_size;
+        size_t amount = std::min(count - done, _page_size - page_offset);
+        memcpy(_buf.data() + done, page((offset + done) / _page_size) + page_offset, amount);
+        done += amount;
+    }
+    return _buf.data();
+}
+
+bool cached_image::persistent_views() const {
+    return false;
+}
+
+int cached_image::backing_fd(size_t &offset) const {
+    return _parent.get()->backing_fd(offset);
+}
+
+void cached_image::prefetch(size_t offset, size_t count) {
+    _parent.get()->prefetch(offset, count);
+}
+
+bool cached_image::writable() const {
+    return _parent.get()->writable();
+}
+
+void cached_image::write(const void *buf, size_t count, size_t offset) {
+    _parent.get()->write(buf, count, offset);
+    if (count == 0) {
+        return;
+    }
+    // update the pages that are cached, the rest is read from the parent when needed
+    for (size_t index = offset / _page_size; index <= ((offset + count - 1) / _page_size); index++) {
+        auto it = _index.find(index);
+        if (it == _index.end()) {
+            continue;
+        }
+        std::vector<uint8_t> &data = _slots[it->second].data;
+        size_t page_start = index * _page_size;
+        size_t start = std::max(offset, page_start);
+        size_t end = std::min(offset + count, page_start + data.size());
+        memcpy(data.data() + (start - page_start), (const uint8_t *)buf + (start - offset), end - start);
+    }
+}
+
+const struct cache_stats &cached_image::stats() const {
+    return _stats;
+}
+
+std::shared_ptr<image> open_image(const char *path, bool writable) {
+#ifdef HAVE_MMAP
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+        void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            return std::make_shared<mmap_image>((const uint8_t *)data, (size_t)st.st_size, fd, writable);
+        }
+    }
+    close(fd);
+#endif
+    std::ios::openmode mode = writable ? (std::ios::in | std::ios::out | std::ios::binary) : (std::ios::in | std::ios::binary);
+    auto stream = std::make_shared<std::fstream>(path, mode);
+    if (!stream.get()->is_open()) {
+        return nullptr;
+    }
+    return std::make_shared<stream_image>(stream);
+}
+
+void write_all(int fd, const void *buf, size_t count) {
+    const uint8_t *p = (const uint8_t *)buf;
+    while (count != 0) {
+        ssize_t n = write(fd, p, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("failed to write output file (") + std::strerror(errno) + ")");
+        }
+        p += n;
+        count -= (size_t)n;
+    }
+}
+
+void copy_image_range(image &img, size_t offset, size_t count, int out_fd) {
+    check_range(img.size(), offset, count);
+#ifdef __linux__
+    size_t file_offset = offset;
+    int in_fd = img.backing_fd(file_offset);
+    bool use_copy_file_range = true;
+    while ((in_fd >= 0) && (count != 0)) {
+        ssize_t n;
+        if (use_copy_file_range) {
+            loff_t off = (loff_t)file_offset;
+            n = copy_file_range(in_fd, &off, out_fd, nullptr, count, 0);
+            // not supported between these two files, try sendfile next
+            if ((n < 0) && ((errno == EXDEV) || (errno == ENOSYS) || (errno == EINVAL) || (errno == EOPNOTSUPP))) {
+                use_copy_file_range = false;
+                continue;
+            }
+        } else {
+            off_t off = (off_t)file_offset;
+            n = sendfile(out_fd, in_fd, &off, count);
+            if ((n < 0) && ((errno == EINVAL) || (errno == ENOSYS))) {
+                break;
+            }
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("failed to copy image data (") + std::strerror(errno) + ")");
+        }
+        if (n == 0) {
+            // file shrunk underneath us, let the fallback report it
+            break;
+        }
+        file_offset += (size_t)n;
+        offset += (size_t)n;
+        count -= (size_t)n;
+    }
+#endif
+    while (count != 0) {
+        size_t chunksize = count > COPY_CHUNK_SIZE ? COPY_CHUNK_SIZE : count;
+        write_all(out_fd, img.view(offset, chunksize), chunksize);
+        offset += chunksize;
+        count -= chunksize;
+    }
+}
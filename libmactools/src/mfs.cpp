@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <cstring>
+#include <mactools/mfs.h>
+
+bool mfs_mdb_valid(const struct mfs_mdb &mdb) {
+    return (mdb.drNmAlBlks <= MFS_MAX_ALLOC_BLOCKS) && (mdb.drAlBlkSiz != 0) && (mdb.drAlBlkSiz % MFS_SECTOR_SIZE == 0) && (mdb.drClpSiz != 0) &&
+           (mdb.drClpSiz % mdb.drAlBlkSiz == 0) && (mdb.drFreeBks <= mdb.drNmAlBlks) &&
+           (((size_t)mdb.drBlLen * MFS_SECTOR_SIZE) >= (mdb.drNmFls * sizeof(struct mfs_dirent)));
+}
+
+void mfs_unpack_alloc_block_map(const uint8_t *packed, size_t count, uint16_t *map) {
+    for (size_t i = 0; i < count; i++) {
+        map[i] = mfs_alloc_block_map_entry(packed, i);
+    }
+}
+
+void mfs_pack_alloc_block_map(const uint16_t *map, size_t count, uint8_t *packed) {
+    memset(packed, 0, mfs_alloc_block_map_size(count));
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = i + (i / 2); // * 1.5
+        uint16_t value = map[i] & 0xFFF;
+        if ((i & 0x01) != 0) {
+            packed[offset] |= value >> 8;
+            packed[offset + 1] = value & 0xFF;
+        } else {
+            packed[offset] = value >> 4;
+            packed[offset + 1] |= (value & 0x0F) << 4;
+        }
+    }
+}
+
+bool mfs_next_dirent(const uint8_t *directory, size_t directory_size, size_t *offset, struct mfs_dirent *dirent, const char **name) {
+    if ((*offset + sizeof(struct mfs_dirent)) > directory_size) {
+        return false;
+    }
+    mfs_dirent_codec::decode(*dirent, &directory[*offset]);
+    size_t name_offset = *offset + sizeof(struct mfs_dirent);
+    if ((name_offset + dirent->flNam) > directory_size) {
+        return false;
+    }
+    *name = (const char *)&directory[name_offset];
+
+    *offset = name_offset + dirent->flNam;
+    // dirents are always aligned to 2-byte boundary
+    if (*offset % 2 != 0) {
+        (*offset)++;
+    }
+    // unused space at the end of a directory block is zero filled
+    while ((*offset < directory_size) && (directory[*offset] == 0)) {
+        (*offset)++;
+    }
+    return true;
+}
+
+bool mfs_dirent_valid(const struct mfs_dirent &dirent) {
+    return ((dirent.flFlags & MFS_DIRENT_FLAGS_USED) != 0) && (dirent.flLgLen <= dirent.flPyLen) && (dirent.flRLgLen <= dirent.flRPyLen) &&
+           (dirent.flNam > 0) && (dirent.flType == 0);
+}
+
+std::string mfs_host_filename(const char *name, size_t len) {
+    std::string ret(name, len);
+    std::replace(ret.begin(), ret.end(), '/', ':');
+    std::replace(ret.begin(), ret.end(), '\0', '_');
+    if (ret.empty() || (ret == ".") || (ret == "..")) {
+        ret.assign(std::max(ret.size(), (size_t)1), '_');
+    }
+    return ret;
+}
@@ -0,0 +1,511 @@
+#include <algorithm>
+#include <cstring>
+#include <mactools/mfsro.h>
+#include <mactools/mount_cache.h>
+#include <vector>
+
+// every disk access goes through here so it shows up in the I/O counters
+// the counters are updated atomically since mfs_pread may be called from several threads at once
+static void mfs_read_disk(struct mfs_driver_state *ctx, void *buf, size_t count, size_t offset) {
+    __atomic_fetch_add(&ctx->stats.read_calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ctx->stats.bytes_read, count, __ATOMIC_RELAXED);
+    if (__atomic_exchange_n(&ctx->stats.next_offset, offset + count, __ATOMIC_RELAXED) != offset) {
+        __atomic_fetch_add(&ctx->stats.seeks, 1, __ATOMIC_RELAXED);
+    }
+    ctx->read_disk(ctx->disk, buf, count, offset);
+}
+
+#ifndef MFSRO_NO_ALLOC_MAP_CACHE
+static uint16_t get_alloc_block_map_value(struct mfs_driver_state *ctx, uint16_t index) {
+    index &= 0xFFF;
+    if ((index < 2) || (index >= (ctx->mdb.drNmAlBlks + 2))) {
+        return MFS_ALLOC_BLOCK_MAP_FREE;
+    }
+    return ctx->alloc_map[index - 2];
+}
+
+// reads the whole allocation block map at once and unpacks the 12-bit entries
+static void load_alloc_block_map(struct mfs_driver_state *ctx) {
+    size_t count = ctx->mdb.drNmAlBlks;
+    size_t packed_size = mfs_alloc_block_map_size(count);
+    uint8_t *packed = new uint8_t[packed_size];
+    ctx->alloc_map = new uint16_t[count];
+    mfs_read_disk(ctx, packed, packed_size, ctx->disk_part_start + MFS_ALLOC_BLOCK_MAP_OFFSET);
+    mfs_unpack_alloc_block_map(packed, count, ctx->alloc_map);
+    delete[] packed;
+}
+#else
+static uint16_t get_alloc_block_map_value(struct mfs_driver_state *ctx, uint16_t index) {
+    index &= 0xFFF;
+    index -= 2;
+    size_t allocmap_byte_offset = index + (index / 2); // * 1.5
+    uint8_t raw[2];
+    mfs_read_disk(ctx, raw, sizeof(raw), ctx->disk_part_start + MFS_ALLOC_BLOCK_MAP_OFFSET + allocmap_byte_offset);
+    uint16_t value = load_be<uint16_t>(raw);
+    // value = (index & 0x01) != 0 ? value >> 4 : value & 0xFFF;
+    value = (index & 0x01) != 0 ? value & 0xFFF : value >> 4;
+    return value;
+}
+#endif
+
+static bool mfs_namecmp(const char *mfs_name, const char *c_str, size_t mfs_name_len) {
+    size_t i;
+    for (i = 0; (i < mfs_name_len) && (*c_str != '\0'); i++) {
+        if (mfs_name[i] != *c_str++) {
+            return false;
+        }
+    }
+    return *c_str == '\0' && i == mfs_name_len;
+}
+
+static uint32_t mfs_namehash(const char *name, size_t len) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void build_dir_hash(struct mfs_driver_state *ctx) {
+    // open addressing with linear probing, slots hold entry index + 1 so zero means empty
+    ctx->dir_hash_size = 1;
+    while (ctx->dir_hash_size < ((uint32_t)ctx->dir_entry_count * 2)) {
+        ctx->dir_hash_size <<= 1;
+    }
+    ctx->dir_hash = new uint16_t[ctx->dir_hash_size]();
+    for (uint16_t i = 0; i < ctx->dir_entry_count; i++) {
+        uint32_t slot = mfs_namehash(ctx->dir_entries[i].name, ctx->dir_entries[i].dirent.flNam) & (ctx->dir_hash_size - 1);
+        while (ctx->dir_hash[slot] != 0) {
+            slot = (slot + 1) & (ctx->dir_hash_size - 1);
+        }
+        ctx->dir_hash[slot] = i + 1;
+    }
+}
+
+// reads the whole directory at once and builds the entry table and its name index
+static void load_directory(struct mfs_driver_state *ctx) {
+    size_t directory_size = (size_t)ctx->mdb.drBlLen * MFS_SECTOR_SIZE;
+    ctx->directory = new uint8_t[directory_size];
+    mfs_read_disk(ctx, ctx->directory, directory_size, ctx->disk_part_start + ((size_t)ctx->mdb.drDirSt * MFS_SECTOR_SIZE));
+
+    ctx->dir_entries = new struct mfs_dir_entry[ctx->mdb.drNmFls];
+    ctx->dir_entry_count = 0;
+    size_t offset = 0;
+    struct mfs_dirent dirent;
+    const char *name;
+    for (uint16_t i = 0; (i < ctx->mdb.drNmFls) && mfs_next_dirent(ctx->directory, directory_size, &offset, &dirent, &name); i++) {
+        if (mfs_dirent_valid(dirent)) {
+            ctx->dir_entries[ctx->dir_entry_count++] = {dirent, name};
+        }
+    }
+    build_dir_hash(ctx);
+}
+
+static bool mfs_find_file(struct mfs_driver_state *ctx, struct mfs_dirent *dirent, const char *filename) {
+    size_t len = strlen(filename);
+    uint32_t slot = mfs_namehash(filename, len) & (ctx->dir_hash_size - 1);
+    while (ctx->dir_hash[slot] != 0) {
+        const struct mfs_dir_entry *entry = &ctx->dir_entries[ctx->dir_hash[slot] - 1];
+        if (mfs_namecmp(entry->name, filename, entry->dirent.flNam)) {
+            *dirent = entry->dirent;
+            return true;
+        }
+        slot = (slot + 1) & (ctx->dir_hash_size - 1);
+    }
+    return false;
+}
+
+static void reset_state(struct mfs_driver_state *ctx, mfs_read_disk_fn read_disk, void *disk, size_t disk_part_start) {
+    ctx->read_disk = read_disk;
+    ctx->prefetch_disk = nullptr;
+    ctx->disk = disk;
+    ctx->disk_part_start = disk_part_start;
+#ifndef MFSRO_NO_ALLOC_MAP_CACHE
+    ctx->alloc_map = nullptr;
+#endif
+    ctx->directory = nullptr;
+    ctx->dir_entries = nullptr;
+    ctx->dir_entry_count = 0;
+    ctx->dir_hash = nullptr;
+    ctx->dir_hash_size = 0;
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+int init_mfs_driver(struct mfs_driver_state *ctx, mfs_read_disk_fn read_disk, void *disk, size_t disk_part_start) {
+    reset_state(ctx, read_disk, disk, disk_part_start);
+    uint8_t mdb_raw[sizeof(struct mfs_mdb)];
+    mfs_read_disk(ctx, mdb_raw, sizeof(mdb_raw), ctx->disk_part_start + MFS_MDB_OFFSET);
+    mfs_mdb_codec::decode(ctx->mdb, mdb_raw);
+    if (ctx->mdb.drSigWord != MFS_MDB_SIGNATURE) {
+        return -1;
+    }
+
+    // sanity checks
+    if (!mfs_mdb_valid(ctx->mdb)) {
+        return -2;
+    }
+
+#ifndef MFSRO_NO_ALLOC_MAP_CACHE
+    load_alloc_block_map(ctx);
+#endif
+
+    uint16_t dirent_block_count = 0;
+    int state = 0;
+    for (uint16_t i = 2; i < (ctx->mdb.drNmAlBlks + 2); i++) {
+        if (get_alloc_block_map_value(ctx, i) == MFS_ALLOC_BLOCK_MAP_DIRENTS) {
+            dirent_block_count++;
+            if (state == 0) {
+                state = 1;
+            }
+        } else {
+            if (state == 1) {
+                return -3;
+            }
+        }
+    }
+    // TODO: more sanity checks on dirent_block_count
+
+    load_directory(ctx);
+
+    return 0;
+}
+
+int init_mfs_driver_cached(struct mfs_driver_state *ctx, mfs_read_disk_fn read_disk, void *disk, const mount_cache &cache) {
+    reset_state(ctx, read_disk, disk, cache.disk_part_start());
+    // the cache only holds volumes that passed the checks in init_mfs_driver
+    ctx->mdb = cache.mdb();
+#ifndef MFSRO_NO_ALLOC_MAP_CACHE
+    ctx->alloc_map = new uint16_t[ctx->mdb.drNmAlBlks];
+    std::copy(cache.alloc_map(), cache.alloc_map() + ctx->mdb.drNmAlBlks, ctx->alloc_map);
+#endif
+
+    // the names are packed one after another, entries point into that copy instead of the raw directory
+    size_t names_size = 0;
+    for (size_t i = 0; i < cache.file_count(); i++) {
+        names_size += cache.file(i).dirent.flNam;
+    }
+    ctx->directory = new uint8_t[names_size];
+    ctx->dir_entries = new struct mfs_dir_entry[cache.file_count()];
+    size_t offset = 0;
+    for (size_t i = 0; i < cache.file_count(); i++) {
+        const struct mfs_dirent &dirent = cache.file(i).dirent;
+        memcpy(&ctx->directory[offset], cache.name(i), dirent.flNam);
+        ctx->dir_entries[ctx->dir_entry_count++] = {dirent, (const char *)&ctx->directory[offset]};
+        offset += dirent.flNam;
+    }
+    build_dir_hash(ctx);
+    return 0;
+}
+
+void deinit_mfs_driver(struct mfs_driver_state *ctx) {
+#ifndef MFSRO_NO_ALLOC_MAP_CACHE
+    delete[] ctx->alloc_map;
+    ctx->alloc_map = nullptr;
+#endif
+    delete[] ctx->directory;
+    ctx->directory = nullptr;
+    delete[] ctx->dir_entries;
+    ctx->dir_entries = nullptr;
+    ctx->dir_entry_count = 0;
+    delete[] ctx->dir_hash;
+    ctx->dir_hash = nullptr;
+    ctx->dir_hash_size = 0;
+}
+
+static bool mfs_is_data_block(struct mfs_driver_state *ctx, uint16_t block) {
+    return (block >= 2) && (block != MFS_ALLOC_BLOCK_MAP_DIRENTS) && (block < (ctx->mdb.drNmAlBlks + 2));
+}
+
+// walks the allocation chain of a fork and stores it as a list of contiguous block runs
+static void mfs_build_extents(struct mfs_driver_state *ctx, struct mfs_file_handle *file) {
+    file->extents = nullptr;
+    file->extent_count = 0;
+
+    uint16_t start_block = file->resource_fork ? file->dirent.flRStBlk : file->dirent.flStBlk;
+    uint32_t file_size =
+        file->resource_fork ? std::min(file->dirent.flRLgLen, file->dirent.flRPyLen) : std::min(file->dirent.flLgLen, file->dirent.flPyLen);
+    uint32_t block_count = (file_size + (ctx->mdb.drAlBlkSiz - 1)) / ctx->mdb.drAlBlkSiz;
+    // a valid chain can never be longer than the volume
+    block_count = std::min(block_count, (uint32_t)ctx->mdb.drNmAlBlks);
+
+    // the runs are collected first so each chain is only followed once
+    std::vector<struct mfs_extent> extents;
+    uint16_t current_block = start_block;
+    uint16_t previous_block = 0;
+    for (uint32_t i = 0; (i < block_count) && mfs_is_data_block(ctx, current_block); i++) {
+        if (current_block != (previous_block + 1)) {
+            extents.push_back({i * ctx->mdb.drAlBlkSiz, current_block, 0});
+        }
+        extents.back().block_count++;
+        previous_block = current_block;
+        current_block = get_alloc_block_map_value(ctx, current_block);
+        ctx->stats.chain_hops++;
+    }
+    if (extents.empty()) {
+        return;
+    }
+    file->extents = new struct mfs_extent[extents.size()];
+    std::copy(extents.begin(), extents.end(), file->extents);
+    file->extent_count = extents.size();
+}
+
+void mfs_fill_mount_cache(struct mfs_driver_state *ctx, struct mount_cache_data &data) {
+    data.disk_part_start = ctx->disk_part_start;
+    data.mdb = ctx->mdb;
+    char volume_name[MFS_VOLUME_NAME_MAX];
+    mfs_read_disk(ctx, volume_name, sizeof(volume_name), ctx->disk_part_start + MFS_MDB_OFFSET + sizeof(struct mfs_mdb));
+    data.volume_name.assign(volume_name, std::min((size_t)ctx->mdb.drVN, sizeof(volume_name)));
+    data.alloc_map.resize(ctx->mdb.drNmAlBlks);
+#ifndef MFSRO_NO_ALLOC_MAP_CACHE
+    std::copy(ctx->alloc_map, ctx->alloc_map + ctx->mdb.drNmAlBlks, data.alloc_map.begin());
+#else
+    std::vector<uint8_t> packed(mfs_alloc_block_map_size(ctx->mdb.drNmAlBlks));
+    mfs_read_disk(ctx, packed.data(), packed.size(), ctx->disk_part_start + MFS_ALLOC_BLOCK_MAP_OFFSET);
+    mfs_unpack_alloc_block_map(packed.data(), ctx->mdb.drNmAlBlks, data.alloc_map.data());
+#endif
+
+    data.files.clear();
+    data.extents.clear();
+    data.names.clear();
+    for (uint16_t i = 0; i < ctx->dir_entry_count; i++) {
+        const struct mfs_dir_entry &e = ctx->dir_entries[i];
+        struct mount_cache_file f;
+        memset(&f, 0, sizeof(f));
+        f.dirent = e.dirent;
+        f.name_offset = data.names.size();
+        f.first_extent = data.extents.size();
+        data.names.append(e.name, e.dirent.flNam);
+        for (int fork = 0; fork < 2; fork++) {
+            struct mfs_file_handle file;
+            file.dirent = e.dirent;
+            file.resource_fork = fork != 0;
+            mfs_build_extents(ctx, &file);
+            data.extents.insert(data.extents.end(), file.extents, file.extents + file.extent_count);
+            f.extent_count[fork] = file.extent_count;
+            delete[] file.extents;
+        }
+        data.files.push_back(f);
+    }
+}
+
+void mfs_set_prefetch(struct mfs_driver_state *ctx, mfs_prefetch_disk_fn prefetch_disk) {
+    ctx->prefetch_disk = prefetch_disk;
+}
+
+bool mfs_open_file(struct mfs_driver_state *ctx, struct mfs_file_handle *file, const char *path, bool resource_fork) {
+    if (!mfs_find_file(ctx, &file->dirent, path)) {
+        file->open = false;
+        return false;
+    }
+    file->seekpos = 0;
+    file->resource_fork = resource_fork;
+    file->open = true;
+    mfs_build_extents(ctx, file);
+    return true;
+}
+
+void mfs_close_file(struct mfs_driver_state *ctx, struct mfs_file_handle *file) {
+    if (!file->open) {
+        return;
+    }
+    delete[] file->extents;
+    file->extents = nullptr;
+    file->extent_count = 0;
+    file->open = false;
+}
+
+uint32_t mfs_seek(struct mfs_driver_state *ctx, struct mfs_file_handle *file, int32_t pos, uint8_t flags) {
+    if (!file->open) {
+        return 0;
+    }
+    if (flags & MFS_SEEK_CURRENT) {
+        file->seekpos += pos;
+    } else if (flags & MFS_SEEK_END) {
+        file->seekpos = file->resource_fork ? file->dirent.flRLgLen : file->dirent.flLgLen;
+        file->seekpos += pos;
+    } else if (flags & MFS_SEEK_BEGIN) {
+        file->seekpos = pos;
+    }
+
+    file->seekpos = std::min(file->resource_fork ? file->dirent.flRLgLen : file->dirent.flLgLen, file->seekpos);
+    return file->seekpos;
+}
+
+// returns the index of the last extent starting at or before pos
+static uint16_t mfs_find_extent(struct mfs_file_handle *file, uint32_t pos) {
+    uint16_t lo = 0;
+    uint16_t hi = file->extent_count;
+    while ((hi - lo) > 1) {
+        uint16_t mid = lo + ((hi - lo) / 2);
+        if (file->extents[mid].file_offset <= pos) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static uint32_t mfs_fork_size(struct mfs_file_handle *file) {
+    return file->resource_fork ? std::min(file->dirent.flRLgLen, file->dirent.flRPyLen) : std::min(file->dirent.flLgLen, file->dirent.flPyLen);
+}
+
+uint32_t mfs_map(struct mfs_driver_state *ctx, struct mfs_file_handle *file, uint32_t pos, size_t *disk_offset) {
+    if (!file->open || (file->extent_count == 0)) {
+        return 0;
+    }
+    uint32_t file_size = mfs_fork_size(file);
+    if (pos >= file_size) {
+        return 0;
+    }
+
+    const struct mfs_extent *extent = &file->extents[mfs_find_extent(file, pos)];
+    uint32_t extent_offset = pos - extent->file_offset;
+    uint32_t extent_size = (uint32_t)extent->block_count * ctx->mdb.drAlBlkSiz;
+    if (extent_offset >= extent_size) {
+        // chain ended before the file did
+        return 0;
+    }
+    *disk_offset = ctx->disk_part_start + mfs_alloc_block_offset(ctx->mdb, extent->start_block) + extent_offset;
+    return std::min(extent_size - extent_offset, file_size - pos);
+}
+
+uint32_t mfs_pread(struct mfs_driver_state *ctx, struct mfs_file_handle *file, void *buf, uint32_t count, uint32_t offset) {
+    if (!file->open || (file->extent_count == 0)) {
+        return 0;
+    }
+    uint32_t file_size = mfs_fork_size(file);
+    if (offset >= file_size) {
+        return 0;
+    }
+    count = std::min(count, file_size - offset);
+
+    uint32_t leftover_read_count = count;
+    for (uint16_t i = mfs_find_extent(file, offset); (i < file->extent_count) && (leftover_read_count != 0); i++) {
+        const struct mfs_extent *extent = &file->extents[i];
+        uint32_t pos = offset + (count - leftover_read_count);
+        uint32_t extent_offset = pos - extent->file_offset;
+        uint32_t extent_size = (uint32_t)extent->block_count * ctx->mdb.drAlBlkSiz;
+        if (extent_offset >= extent_size) {
+            // chain ended before the file did
+            break;
+        }
+        uint32_t read_amount = std::min(leftover_read_count, extent_size - extent_offset);
+
+        mfs_read_disk(ctx,
+                      (uint8_t *)buf + (count - leftover_read_count),
+                      read_amount,
+                      ctx->disk_part_start + mfs_alloc_block_offset(ctx->mdb, extent->start_block) + extent_offset);
+
+        leftover_read_count -= read_amount;
+    }
+
+    return count - leftover_read_count;
+}
+
+uint32_t mfs_read(struct mfs_driver_state *ctx, struct mfs_file_handle *file, void *buf, uint32_t count) {
+    if (!file->open) {
+        return 0;
+    }
+    file->seekpos = std::min(file->seekpos, mfs_fork_size(file));
+    uint32_t read = mfs_pread(ctx, file, buf, count, file->seekpos);
+    file->seekpos += read;
+    return read;
+}
+
+// a piece of a requested range that is stored contiguously on disk
+struct mfs_read_segment {
+    size_t disk_offset;
+    uint32_t count;
+    uint8_t *dest;
+};
+
+size_t mfs_preadv(struct mfs_driver_state *ctx, struct mfs_file_handle *file, struct mfs_read_range *ranges, size_t range_count) {
+    std::vector<struct mfs_read_segment> segments;
+    for (size_t i = 0; i < range_count; i++) {
+        struct mfs_read_range &range = ranges[i];
+        range.done = 0;
+        size_t disk_offset;
+        uint32_t run;
+        // done is how much of the range maps to the fork, it only counts as read once the disk has been read below
+        while ((range.done < range.count) && ((run = mfs_map(ctx, file, range.offset + range.done, &disk_offset)) != 0)) {
+            run = std::min(run, range.count - range.done);
+            segments.push_back({disk_offset, run, (uint8_t *)range.buf + range.done});
+            range.done += run;
+        }
+    }
+    std::sort(segments.begin(), segments.end(), [](const struct mfs_read_segment &a, const struct mfs_read_segment &b) {
+        return a.disk_offset < b.disk_offset;
+    });
+
+    // segments touching or overlapping on disk are read with a single call
+    size_t total = 0;
+    std::vector<uint8_t> scratch;
+    for (size_t first = 0; first < segments.size();) {
+        size_t start = segments[first].disk_offset;
+        size_t end = start + segments[first].count;
+        size_t last = first + 1;
+        while ((last < segments.size()) && (segments[last].disk_offset <= end)) {
+            end = std::max(end, segments[last].disk_offset + segments[last].count);
+            last++;
+        }
+        if ((last - first) == 1) {
+            mfs_read_disk(ctx, segments[first].dest, end - start, start);
+        } else {
+            scratch.resize(end - start);
+            mfs_read_disk(ctx, scratch.data(), scratch.size(), start);
+            for (size_t i = first; i < last; i++) {
+                memcpy(segments[i].dest, &scratch[segments[i].disk_offset - start], segments[i].count);
+            }
+        }
+        for (size_t i = first; i < last; i++) {
+            total += segments[i].count;
+        }
+        first = last;
+    }
+    return total;
+}
+
+static void mfs_prefetch(struct mfs_driver_state *ctx, struct mfs_file_handle *file, uint32_t pos, uint32_t count) {
+    size_t disk_offset;
+    uint32_t run;
+    while ((count != 0) && ((run = mfs_map(ctx, file, pos, &disk_offset)) != 0)) {
+        run = std::min(run, count);
+        ctx->prefetch_disk(ctx->disk, run, disk_offset);
+        pos += run;
+        count -= run;
+    }
+}
+
+uint32_t mfs_stream(struct mfs_driver_state *ctx,
+                    struct mfs_file_handle *file,
+                    void *buf,
+                    uint32_t chunk_size,
+                    uint32_t readahead,
+                    mfs_stream_fn fn,
+                    void *user) {
+    if (!file->open || (chunk_size == 0)) {
+        return 0;
+    }
+    uint32_t total = 0;
+    // the read-ahead window is extended by one chunk each time one is read
+    if ((ctx->prefetch_disk != nullptr) && (readahead != 0)) {
+        mfs_prefetch(ctx, file, file->seekpos + chunk_size, chunk_size * readahead);
+    }
+    while (true) {
+        uint32_t read = mfs_read(ctx, file, buf, chunk_size);
+        if (read == 0) {
+            break;
+        }
+        if ((ctx->prefetch_disk != nullptr) && (readahead != 0)) {
+            mfs_prefetch(ctx, file, file->seekpos + (chunk_size * readahead), chunk_size);
+        }
+        total += read;
+        if (!fn(user, buf, read)) {
+            break;
+        }
+    }
+    return total;
+}
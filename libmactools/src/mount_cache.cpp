@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mactools/hash.h>
+#include <mactools/mount_cache.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(struct mount_cache_header) == 128, "mount cache header layout changed");
+static_assert(sizeof(struct mount_cache_file) == 64, "mount cache file layout changed");
+static_assert(sizeof(struct mfs_extent) == 8, "mount cache extent layout changed");
+
+static uint64_t align8(uint64_t x) {
+    return (x + 7) & ~(uint64_t)7;
+}
+
+// offsets of the tables following the header
+struct mount_cache_layout {
+    uint64_t path;
+    uint64_t alloc_map;
+    uint64_t files;
+    uint64_t extents;
+    uint64_t names;
+    uint64_t end;
+};
+
+static struct mount_cache_layout layout_of(const struct mount_cache_header &header) {
+    struct mount_cache_layout l;
+    l.path = sizeof(header);
+    l.alloc_map = align8(l.path + header.path_length);
+    l.files = align8(l.alloc_map + ((uint64_t)header.mdb.drNmAlBlks * sizeof(uint16_t)));
+    l.extents = align8(l.files + ((uint64_t)header.file_count * sizeof(struct mount_cache_file)));
+    l.names = align8(l.extents + ((uint64_t)header.extent_count * sizeof(struct mfs_extent)));
+    l.end = l.names + header.names_size;
+    return l;
+}
+
+static bool absolute_path(const std::string &path, std::string &abs) {
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved) == nullptr) {
+        return false;
+    }
+    abs = resolved;
+    return true;
+}
+
+std::string mount_cache_path(const std::string &cache_dir, const std::string &image_path) {
+    std::string abs;
+    if (!absolute_path(image_path, abs)) {
+        abs = image_path;
+    }
+    xxh64 h;
+    h.update(abs.data(), abs.size());
+    char name[32];
+    snprintf(name, sizeof(name), "%016" PRIx64 ".mount", h.digest());
+    return cache_dir + "/" + name;
+}
+
+bool mount_cache_stat(const std::string &image_path, struct mount_cache_data &data) {
+    struct stat st;
+    if (!absolute_path(image_path, data.image_path) || (stat(data.image_path.c_str(), &st) != 0)) {
+        return false;
+    }
+    data.image_size = (uint64_t)st.st_size;
+    data.image_mtime_ns = ((int64_t)st.st_mtim.tv_sec * 1000000000) + st.st_mtim.tv_nsec;
+    return true;
+}
+
+// the extents have to lie on the volume, everything else the drivers check as they go
+static bool extents_valid(const struct mfs_mdb &mdb, const struct mfs_extent *extents, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if ((extents[i].start_block < 2) || (((size_t)extents[i].start_block + extents[i].block_count) > ((size_t)mdb.drNmAlBlks + 2))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<mount_cache> open_mount_cache(const std::string &path, const std::string &image_path) {
+    struct mount_cache_data key;
+    if (!mount_cache_stat(image_path, key)) {
+        return nullptr;
+    }
+    std::shared_ptr<mount_cache> cache(new mount_cache());
+    cache->_file = open_image(path.c_str());
+    if ((cache->_file == nullptr) || (cache->_file->size() < sizeof(struct mount_cache_header))) {
+        return nullptr;
+    }
+    size_t size = cache->_file->size();
+    const uint8_t *data;
+    try {
+        data = cache->_file->view(0, size);
+    } catch (const std::exception &) {
+        return nullptr;
+    }
+    const struct mount_cache_header &header = *(const struct mount_cache_header *)data;
+    if ((memcmp(header.magic, MOUNT_CACHE_MAGIC, sizeof(header.magic)) != 0) || (header.version != MOUNT_CACHE_VERSION) ||
+        (header.byte_order != MOUNT_CACHE_BYTE_ORDER) || (header.image_size != key.image_size) ||
+        (header.image_mtime_ns != key.image_mtime_ns)) {
+        return nullptr;
+    }
+    struct mount_cache_layout l = layout_of(header);
+    if ((l.end != size) || (header.path_length != key.image_path.size()) ||
+        (memcmp(data + l.path, key.image_path.data(), header.path_length) != 0) || !mfs_mdb_valid(header.mdb) ||
+        (header.file_count > header.mdb.drNmFls)) {
+        return nullptr;
+    }
+    xxh64 h;
+    h.update(data + sizeof(header), size - sizeof(header));
+    if (h.digest() != header.payload_hash) {
+        return nullptr;
+    }
+
+    cache->_header = &header;
+    cache->_alloc_map = (const uint16_t *)(data + l.alloc_map);
+    cache->_files = (const struct mount_cache_file *)(data + l.files);
+    cache->_extents = (const struct mfs_extent *)(data + l.extents);
+    cache->_names = (const char *)(data + l.names);
+    for (size_t i = 0; i < header.file_count; i++) {
+        const struct mount_cache_file &f = cache->_files[i];
+        uint64_t extent_count = (uint64_t)f.extent_count[0] + f.extent_count[1];
+        if ((((uint64_t)f.name_offset + f.dirent.flNam) > header.names_size) ||
+            (((uint64_t)f.first_extent + extent_count) > header.extent_count) ||
+            !extents_valid(header.mdb, &cache->_extents[f.first_extent], extent_count)) {
+            return nullptr;
+        }
+    }
+    return cache;
+}
+
+bool write_mount_cache(const std::string &path, const struct mount_cache_data &data) {
+    struct mount_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MOUNT_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MOUNT_CACHE_VERSION;
+    header.byte_order = MOUNT_CACHE_BYTE_ORDER;
+    header.image_size = data.image_size;
+    header.image_mtime_ns = data.image_mtime_ns;
+    header.disk_part_start = data.disk_part_start;
+    header.path_length = data.image_path.size();
+    header.file_count = data.files.size();
+    header.extent_count = data.extents.size();
+    header.names_size = data.names.size();
+    header.mdb = data.mdb;
+    memcpy(header.volume_name, data.volume_name.data(), std::min(data.volume_name.size(), sizeof(header.volume_name)));
+    if (data.alloc_map.size() != data.mdb.drNmAlBlks) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // assembled in memory first since the hash covers all of it, a cache file is a few KB
+    struct mount_cache_layout l = layout_of(header);
+    std::vector<uint8_t> buf(l.end, 0);
+    memcpy(&buf[l.path], data.image_path.data(), data.image_path.size());
+    memcpy(&buf[l.alloc_map], data.alloc_map.data(), data.alloc_map.size() * sizeof(uint16_t));
+    memcpy(&buf[l.files], data.files.data(), data.files.size() * sizeof(struct mount_cache_file));
+    memcpy(&buf[l.extents], data.extents.data(), data.extents.size() * sizeof(struct mfs_extent));
+    memcpy(&buf[l.names], data.names.data(), data.names.size());
+    xxh64 h;
+    h.update(&buf[sizeof(header)], buf.size() - sizeof(header));
+    header.payload_hash = h.digest();
+    memcpy(&buf[0], &header, sizeof(header));
+
+    // concurrent writers of the same cache file, also threads of one process, each get their own temporary file from mkstemp
+    std::string tmpname = path + ".XXXXXX";
+    int fd = mkstemp(&tmpname[0]);
+    if (fd < 0) {
+        return false;
+    }
+    FILE *f = fdopen(fd, "wb");
+    if ((f == nullptr) || (fchmod(fd, 0644) != 0)) {
+        int err = errno;
+        if (f != nullptr) {
+            fclose(f);
+        } else {
+            close(fd);
+        }
+        remove(tmpname.c_str());
+        errno = err;
+        return false;
+    }
+    bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+    if ((fclose(f) != 0) || !ok || (rename(tmpname.c_str(), path.c_str()) != 0)) {
+        int err = errno;
+        remove(tmpname.c_str());
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+size_t mount_cache::disk_part_start() const {
+    return _header->disk_part_start;
+}
+
+const struct mfs_mdb &mount_cache::mdb() const {
+    return _header->mdb;
+}
+
+std::string mount_cache::volume_name() const {
+    return std::string(_header->volume_name, std::min((size_t)_header->mdb.drVN, sizeof(_header->volume_name)));
+}
+
+const uint16_t *mount_cache::alloc_map() const {
+    return _alloc_map;
+}
+
+size_t mount_cache::file_count() const {
+    return _header->file_count;
+}
+
+const struct mount_cache_file &mount_cache::file(size_t index) const {
+    return _files[index];
+}
+
+const char *mount_cache::name(size_t index) const {
+    return _names + _files[index].name_offset;
+}
+
+const struct mfs_extent *mount_cache::extents(size_t index, bool resource_fork) const {
+    const struct mount_cache_file &f = _files[index];
+    return &_extents[f.first_extent + (resource_fork ? f.extent_count[0] : 0)];
+}
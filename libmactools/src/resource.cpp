@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <mactools/endian.h>
+#include <mactools/resource.h>
+#include <stdexcept>
+
+#define RESOURCE_HEADER_SIZE (16)
+// copy of the header, next map handle, file reference number, attributes, type and name list offsets
+#define RESOURCE_MAP_HEADER_SIZE (28)
+#define RESOURCE_TYPE_ENTRY_SIZE (8)
+#define RESOURCE_REF_ENTRY_SIZE  (12)
+#define RESOURCE_NO_NAME         (0xFFFF)
+
+// orders by type and then signed ID
+static uint64_t cache_key_of(uint32_t type, int16_t id) {
+    return ((uint64_t)type << 16) | (uint16_t)((uint16_t)id ^ 0x8000);
+}
+
+resource_fork::resource_fork(resource_read_fn read, size_t fork_size, size_t cache_size) {
+    _read = read;
+    _fork_size = fork_size;
+    _cache_size = cache_size;
+    _cached_bytes = 0;
+    _stats = {0, 0, 0};
+    load_map();
+}
+
+resource_fork::resource_fork(struct mfs_driver_state *ctx, struct mfs_file_handle *file, size_t cache_size)
+    : resource_fork(
+          [ctx, file](void *buf, size_t count, size_t offset) -> size_t {
+              if (mfs_seek(ctx, file, (int32_t)offset, MFS_SEEK_BEGIN) != offset) {
+                  return 0;
+              }
+              return mfs_read(ctx, file, buf, (uint32_t)count);
+          },
+          mfs_seek(ctx, file, 0, MFS_SEEK_END),
+          cache_size) {}
+
+void resource_fork::read_exact(void *buf, size_t count, size_t offset) {
+    if ((count != 0) && (_read(buf, count, offset) != count)) {
+        throw std::runtime_error("short read from resource fork");
+    }
+}
+
+void resource_fork::load_map() {
+    if (_fork_size < RESOURCE_HEADER_SIZE) {
+        throw std::runtime_error("not a resource fork");
+    }
+    uint8_t header[RESOURCE_HEADER_SIZE];
+    read_exact(header, sizeof(header), 0);
+    _data_offset = load_be<uint32_t>(&header[0]);
+    uint32_t map_offset = load_be<uint32_t>(&header[4]);
+    _data_size = load_be<uint32_t>(&header[8]);
+    uint32_t map_size = load_be<uint32_t>(&header[12]);
+    if (((uint64_t)_data_offset + _data_size > _fork_size) || ((uint64_t)map_offset + map_size > _fork_size) ||
+        (map_size < (RESOURCE_MAP_HEADER_SIZE + 2))) {
+        throw std::runtime_error("invalid resource fork header");
+    }
+
+    // the map is usually a few hundred bytes to a few KB, it is the only part read as a whole
+    _map.resize(map_size);
+    read_exact(_map.data(), map_size, map_offset);
+    uint16_t type_list = load_be<uint16_t>(&_map[24]);
+    _name_list_offset = load_be<uint16_t>(&_map[26]);
+    if (((size_t)type_list + 2) > map_size) {
+        throw std::runtime_error("invalid resource map");
+    }
+
+    // counts are stored minus one, so an empty list is 0xFFFF
+    size_t type_count = (uint16_t)(load_be<uint16_t>(&_map[type_list]) + 1);
+    for (size_t t = 0; t < type_count; t++) {
+        size_t entry = type_list + 2 + (t * RESOURCE_TYPE_ENTRY_SIZE);
+        if ((entry + RESOURCE_TYPE_ENTRY_SIZE) > map_size) {
+            throw std::runtime_error("invalid resource map");
+        }
+        uint32_t type = load_be<uint32_t>(&_map[entry]);
+        size_t ref_count = (size_t)load_be<uint16_t>(&_map[entry + 4]) + 1;
+        size_t ref_list = type_list + load_be<uint16_t>(&_map[entry + 6]);
+        if ((ref_list + (ref_count * RESOURCE_REF_ENTRY_SIZE)) > map_size) {
+            throw std::runtime_error("invalid resource map");
+        }
+        _types.push_back(type);
+        for (size_t i = 0; i < ref_count; i++) {
+            const uint8_t *ref = &_map[ref_list + (i * RESOURCE_REF_ENTRY_SIZE)];
+            // attributes share a word with the 24-bit data offset
+            uint32_t attributes_offset = load_be<uint32_t>(&ref[4]);
+            _refs.push_back({type, (int16_t)load_be<uint16_t>(&ref[0]), (uint8_t)(attributes_offset >> 24), load_be<uint16_t>(&ref[2]),
+                             attributes_offset & 0xFFFFFF});
+        }
+    }
+    std::stable_sort(_refs.begin(), _refs.end(), [](const struct resource_ref &a, const struct resource_ref &b) {
+        return cache_key_of(a.type, a.id) < cache_key_of(b.type, b.id);
+    });
+}
+
+const struct resource_fork::resource_ref *resource_fork::find(uint32_t type, int16_t id) const {
+    auto it = std::lower_bound(_refs.begin(), _refs.end(), cache_key_of(type, id), [](const struct resource_ref &ref, uint64_t key) {
+        return cache_key_of(ref.type, ref.id) < key;
+    });
+    if ((it == _refs.end()) || (it->type != type) || (it->id != id)) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+struct resource_fork::resource_info resource_fork::info(const struct resource_ref &ref) const {
+    struct resource_info ret = {ref.type, ref.id, ref.attributes, std::string()};
+    size_t name = (size_t)_name_list_offset + ref.name_offset;
+    if ((ref.name_offset != RESOURCE_NO_NAME) && (name < _map.size()) && ((name + 1 + _map[name]) <= _map.size())) {
+        ret.name.assign((const char *)&_map[name + 1], _map[name]);
+    }
+    return ret;
+}
+
+std::vector<uint32_t> resource_fork::types() const {
+    return _types;
+}
+
+std::vector<struct resource_fork::resource_info> resource_fork::list(uint32_t type) const {
+    std::vector<struct resource_info> ret;
+    for (const auto &ref : _refs) {
+        if (ref.type == type) {
+            ret.push_back(info(ref));
+        }
+    }
+    return ret;
+}
+
+bool resource_fork::contains(uint32_t type, int16_t id) const {
+    return find(type, id) != nullptr;
+}
+
+std::shared_ptr<const std::vector<uint8_t>> resource_fork::get(uint32_t type, int16_t id) {
+    const struct resource_ref *ref = find(type, id);
+    if (ref == nullptr) {
+        return nullptr;
+    }
+    cache_key key = cache_key_of(type, id);
+    auto cached = _cache.find(key);
+    if (cached != _cache.end()) {
+        _stats.hits++;
+        _lru.splice(_lru.begin(), _lru, cached->second.lru);
+        return cached->second.data;
+    }
+    _stats.misses++;
+
+    // every resource is its length followed by the data
+    uint8_t length_raw[4];
+    if (((uint64_t)ref->data_offset + sizeof(length_raw)) > _data_size) {
+        throw std::runtime_error("resource data outside of the fork");
+    }
+    read_exact(length_raw, sizeof(length_raw), (size_t)_data_offset + ref->data_offset);
+    uint32_t length = load_be<uint32_t>(length_raw);
+    if (((uint64_t)ref->data_offset + sizeof(length_raw) + length) > _data_size) {
+        throw std::runtime_error("resource data outside of the fork");
+    }
+    std::shared_ptr<std::vector<uint8_t>> data = std::make_shared<std::vector<uint8_t>>(length);
+    read_exact(data->data(), length, (size_t)_data_offset + ref->data_offset + sizeof(length_raw));
+
+    if (length <= _cache_size) {
+        while ((_cached_bytes + length) > _cache_size) {
+            auto victim = _cache.find(_lru.back());
+            _cached_bytes -= victim->second.data->size();
+            _cache.erase(victim);
+            _lru.pop_back();
+            _stats.evictions++;
+        }
+        _lru.push_front(key);
+        _cache[key] = {data, _lru.begin()};
+        _cached_bytes += length;
+    }
+    return data;
+}
+
+const struct cache_stats &resource_fork::stats() const {
+    return _stats;
+}
@@ -0,0 +1,113 @@
+#include <cinttypes>
+#include <functional>
+#include <mactools/trace.h>
+#include <thread>
+
+void add_io_stats(struct io_stats &sum, const struct io_stats &stats) {
+    sum.read_calls += stats.read_calls;
+    sum.bytes_read += stats.bytes_read;
+    sum.seeks += stats.seeks;
+    sum.chain_hops += stats.chain_hops;
+    sum.cache_hits += stats.cache_hits;
+    sum.cache_misses += stats.cache_misses;
+}
+
+trace_log::trace_log() {
+    _epoch = std::chrono::steady_clock::now();
+}
+
+void trace_log::add(const char *name, std::chrono::steady_clock::time_point start) {
+    auto now = std::chrono::steady_clock::now();
+    struct event e;
+    e.name = name;
+    e.start = std::chrono::duration_cast<std::chrono::microseconds>(start - _epoch).count();
+    e.duration = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+    // small, stable numbers make the trace viewer's thread rows readable
+    e.thread = std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000;
+    std::lock_guard<std::mutex> lock(_lock);
+    _events.push_back(e);
+}
+
+std::vector<std::pair<std::string, double>> trace_log::totals() const {
+    std::lock_guard<std::mutex> lock(_lock);
+    std::vector<std::pair<std::string, double>> ret;
+    for (const auto &e : _events) {
+        auto it = ret.begin();
+        while ((it != ret.end()) && (it->first != e.name)) {
+            ++it;
+        }
+        if (it == ret.end()) {
+            it = ret.insert(ret.end(), {e.name, 0.0});
+        }
+        it->second += e.duration / 1000.0;
+    }
+    return ret;
+}
+
+// phase names are plain identifiers, but quotes and backslashes must not break the JSON
+static std::string json_escape(const std::string &s) {
+    std::string ret;
+    for (char c : s) {
+        if ((c == '"') || (c == '\\')) {
+            ret += '\\';
+        }
+        ret += c;
+    }
+    return ret;
+}
+
+bool trace_log::write_chrome_trace(const char *path) const {
+    FILE *f = fopen(path, "w");
+    if (f == nullptr) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_lock);
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < _events.size(); i++) {
+        const struct event &e = _events[i];
+        fprintf(f,
+                "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%" PRIu64 ",\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 "}%s\n",
+                json_escape(e.name).c_str(),
+                e.thread,
+                e.start,
+                e.duration,
+                (i + 1) < _events.size() ? "," : "");
+    }
+    fprintf(f, "],\"displayTimeUnit\":\"ms\"}\n");
+    return fclose(f) == 0;
+}
+
+trace_span::trace_span(trace_log *log, const char *name) {
+    _log = log;
+    _name = name;
+    _start = std::chrono::steady_clock::now();
+}
+
+trace_span::~trace_span() {
+    if (_log != nullptr) {
+        _log->add(_name, _start);
+    }
+}
+
+void print_stats(FILE *out, const struct io_stats &stats, const trace_log *log) {
+    if (stats.read_calls != 0) {
+        fprintf(out,
+                "I/O: %" PRIu64 " reads, %" PRIu64 " bytes, %" PRIu64 " seeks, %" PRIu64 " chain hops\n",
+                stats.read_calls,
+                stats.bytes_read,
+                stats.seeks,
+                stats.chain_hops);
+    }
+    if ((stats.cache_hits + stats.cache_misses) != 0) {
+        fprintf(out,
+                "Cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit rate)\n",
+                stats.cache_hits,
+                stats.cache_misses,
+                (100.0 * stats.cache_hits) / (stats.cache_hits + stats.cache_misses));
+    }
+    if (log != nullptr) {
+        for (const auto &t : log->totals()) {
+            fprintf(out, "Phase %s: %.3f ms\n", t.first.c_str(), t.second);
+        }
+    }
+}
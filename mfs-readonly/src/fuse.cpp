@@ -0,0 +1,326 @@
+#define FUSE_USE_VERSION 31
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fuse.h>
+#include <mactools/diskcopy42.h>
+#include <mactools/image.h>
+#include <mactools/mfsro.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unordered_map>
+#include <vector>
+
+// Linux doesn't look up paths below regular files, the resource fork is available as an extended attribute there
+#define NAMEDFORK_SUFFIX    "/..namedfork/rsrc"
+#define XATTR_RESOURCE_FORK "com.apple.ResourceFork"
+#define XATTR_FINDER_INFO   "com.apple.FinderInfo"
+
+#define PAGE_SIZE_DEFAULT  (4096)
+#define PAGE_COUNT_DEFAULT (256)
+
+struct fuse_file {
+    struct mfs_dirent dirent;
+    std::string name; // name on the MFS volume
+    // opened on first access and kept open, so the extent list of a fork is only built once
+    struct mfs_file_handle forks[2];
+};
+
+struct mfs_fuse {
+    std::shared_ptr<cached_image> disk;
+    struct mfs_driver_state state;
+    std::vector<std::string> names; // host names in directory order
+    std::unordered_map<std::string, struct fuse_file> files;
+    // guards opening the shared handles and the page cache of disk, which isn't thread-safe
+    std::mutex lock;
+};
+
+struct mfs_fuse_options {
+    const char *image;
+    unsigned int cache_pages;
+    int show_help;
+};
+
+static struct fuse_opt option_spec[] = {
+    {"cache_pages=%u", offsetof(struct mfs_fuse_options, cache_pages), 0},
+    {"-h", offsetof(struct mfs_fuse_options, show_help), 1},
+    {"--help", offsetof(struct mfs_fuse_options, show_help), 1},
+    FUSE_OPT_END,
+};
+
+static struct mfs_fuse *get_fs() {
+    return (struct mfs_fuse *)fuse_get_context()->private_data;
+}
+
+static int64_t mactime2unix(uint32_t mactime) {
+    int64_t diff = (int64_t)(60 * 60 * 24) * ((365 * (1970 - 1904)) + (((1970 - 1904) / 4) + 1));
+    return (int64_t)mactime - diff;
+}
+
+// looks up "/name" or "/name/..namedfork/rsrc"
+static struct fuse_file *lookup(const char *path, bool *resource_fork) {
+    std::string name = path[0] == '/' ? path + 1 : path;
+    *resource_fork = false;
+    size_t suffix_len = strlen(NAMEDFORK_SUFFIX);
+    if ((name.size() > suffix_len) && (name.compare(name.size() - suffix_len, suffix_len, NAMEDFORK_SUFFIX) == 0)) {
+        name.resize(name.size() - suffix_len);
+        *resource_fork = true;
+    }
+    auto &files = get_fs()->files;
+    auto it = files.find(name);
+    return it != files.end() ? &it->second : nullptr;
+}
+
+static struct mfs_file_handle *open_fork(struct mfs_fuse *fs, struct fuse_file *file, bool resource_fork) {
+    struct mfs_file_handle *handle = &file->forks[resource_fork ? 1 : 0];
+    if (!handle->open && !mfs_open_file(&fs->state, handle, file->name.c_str(), resource_fork)) {
+        return nullptr;
+    }
+    return handle;
+}
+
+static int read_fork(struct fuse_file *file, bool resource_fork, char *buf, size_t size, off_t offset) {
+    struct mfs_fuse *fs = get_fs();
+    std::lock_guard<std::mutex> guard(fs->lock);
+    struct mfs_file_handle *handle = open_fork(fs, file, resource_fork);
+    if (handle == nullptr) {
+        return -EIO;
+    }
+    uint32_t fork_size = resource_fork ? file->dirent.flRLgLen : file->dirent.flLgLen;
+    if ((uint64_t)offset >= fork_size) {
+        return 0;
+    }
+    size = std::min(size, (size_t)(fork_size - offset));
+    try {
+        return (int)mfs_pread(&fs->state, handle, buf, (uint32_t)size, (uint32_t)offset);
+    } catch (const std::exception &e) {
+        return -EIO;
+    }
+}
+
+static void *mfs_fuse_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
+    // the image is mounted read-only, so nothing changes behind the kernel's back
+    cfg->kernel_cache = 1;
+    cfg->entry_timeout = 3600;
+    cfg->attr_timeout = 3600;
+    return fuse_get_context()->private_data;
+}
+
+static int mfs_fuse_getattr(const char *path, struct stat *st, struct fuse_file_info *fi) {
+    memset(st, 0, sizeof(*st));
+    if (strcmp(path, "/") == 0) {
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+        return 0;
+    }
+    bool resource_fork;
+    struct fuse_file *file = lookup(path, &resource_fork);
+    if (file == nullptr) {
+        return -ENOENT;
+    }
+    st->st_mode = S_IFREG | ((file->dirent.flFlags & MFS_DIRENT_FLAGS_LOCKED) != 0 ? 0444 : 0644);
+    st->st_nlink = 1;
+    st->st_size = resource_fork ? file->dirent.flRLgLen : file->dirent.flLgLen;
+    st->st_blocks = ((resource_fork ? file->dirent.flRPyLen : file->dirent.flPyLen) + 511) / 512;
+    st->st_mtime = mactime2unix(file->dirent.flMdDat);
+    st->st_ctime = st->st_mtime;
+    st->st_atime = st->st_mtime;
+    return 0;
+}
+
+static int mfs_fuse_readdir(const char *path,
+                            void *buf,
+                            fuse_fill_dir_t filler,
+                            off_t offset,
+                            struct fuse_file_info *fi,
+                            enum fuse_readdir_flags flags) {
+    if (strcmp(path, "/") != 0) {
+        return -ENOENT;
+    }
+    filler(buf, ".", nullptr, 0, (enum fuse_fill_dir_flags)0);
+    filler(buf, "..", nullptr, 0, (enum fuse_fill_dir_flags)0);
+    for (const auto &name : get_fs()->names) {
+        filler(buf, name.c_str(), nullptr, 0, (enum fuse_fill_dir_flags)0);
+    }
+    return 0;
+}
+
+static int mfs_fuse_open(const char *path, struct fuse_file_info *fi) {
+    bool resource_fork;
+    if (lookup(path, &resource_fork) == nullptr) {
+        return -ENOENT;
+    }
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        return -EROFS;
+    }
+    return 0;
+}
+
+static int mfs_fuse_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    bool resource_fork;
+    struct fuse_file *file = lookup(path, &resource_fork);
+    if (file == nullptr) {
+        return -ENOENT;
+    }
+    return read_fork(file, resource_fork, buf, size, offset);
+}
+
+static int mfs_fuse_getxattr(const char *path, const char *name, char *value, size_t size) {
+    bool resource_fork;
+    struct fuse_file *file = lookup(path, &resource_fork);
+    if ((file == nullptr) || resource_fork) {
+        return -ENOENT;
+    }
+    if (strcmp(name, XATTR_FINDER_INFO) == 0) {
+        // FInfo followed by an empty FXInfo
+        if (size == 0) {
+            return 32;
+        }
+        if (size < 32) {
+            return -ERANGE;
+        }
+        memset(value, 0, 32);
+        memcpy(value, file->dirent.flUsrWds, sizeof(file->dirent.flUsrWds));
+        return 32;
+    }
+    if ((strcmp(name, XATTR_RESOURCE_FORK) == 0) && (file->dirent.flRLgLen != 0)) {
+        if (size == 0) {
+            return (int)file->dirent.flRLgLen;
+        }
+        if (size < file->dirent.flRLgLen) {
+            return -ERANGE;
+        }
+        return read_fork(file, true, value, file->dirent.flRLgLen, 0);
+    }
+    return -ENODATA;
+}
+
+static int mfs_fuse_listxattr(const char *path, char *list, size_t size) {
+    bool resource_fork;
+    struct fuse_file *file = lookup(path, &resource_fork);
+    if ((file == nullptr) || resource_fork) {
+        return -ENOENT;
+    }
+    std::string names(XATTR_FINDER_INFO, sizeof(XATTR_FINDER_INFO));
+    if (file->dirent.flRLgLen != 0) {
+        names.append(XATTR_RESOURCE_FORK, sizeof(XATTR_RESOURCE_FORK));
+    }
+    if (size == 0) {
+        return (int)names.size();
+    }
+    if (size < names.size()) {
+        return -ERANGE;
+    }
+    memcpy(list, names.data(), names.size());
+    return (int)names.size();
+}
+
+static int mfs_fuse_statfs(const char *path, struct statvfs *st) {
+    const struct mfs_mdb &mdb = get_fs()->state.mdb;
+    memset(st, 0, sizeof(*st));
+    st->f_bsize = mdb.drAlBlkSiz;
+    st->f_frsize = mdb.drAlBlkSiz;
+    st->f_blocks = mdb.drNmAlBlks;
+    st->f_bfree = mdb.drFreeBks;
+    st->f_bavail = mdb.drFreeBks;
+    st->f_files = get_fs()->names.size();
+    st->f_namemax = 255;
+    return 0;
+}
+
+static int opt_proc(void *data, const char *arg, int key, struct fuse_args *outargs) {
+    struct mfs_fuse_options *options = (struct mfs_fuse_options *)data;
+    // the first non-option argument is the image, everything else goes to fuse
+    if ((key == FUSE_OPT_KEY_NONOPT) && (options->image == nullptr)) {
+        options->image = arg;
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct mfs_fuse_options options = {nullptr, PAGE_COUNT_DEFAULT, 0};
+    if (fuse_opt_parse(&args, &options, option_spec, opt_proc) != 0) {
+        return 1;
+    }
+    if (options.show_help || (options.image == nullptr)) {
+        printf("Usage: %s [options] [MFS image filename] [mountpoint]\n", argv[0]);
+        printf("  -o cache_pages=N: number of %d byte pages of the image kept in memory, default %d\n", PAGE_SIZE_DEFAULT, PAGE_COUNT_DEFAULT);
+        printf("  resource forks are exposed as \"name" NAMEDFORK_SUFFIX "\" and the " XATTR_RESOURCE_FORK " attribute\n\n");
+        fuse_opt_add_arg(&args, "--help");
+        args.argv[0][0] = '\0';
+        fuse_main(args.argc, args.argv, nullptr, nullptr);
+        fuse_opt_free_args(&args);
+        return options.show_help ? 0 : 1;
+    }
+
+    std::shared_ptr<image> infile = open_image(options.image);
+    if (infile == nullptr) {
+        fprintf(stderr, "Failed to open input file (%s)\n", std::strerror(errno));
+        return 1;
+    }
+
+    struct mfs_fuse fs;
+    fs.disk = std::make_shared<cached_image>(infile, PAGE_SIZE_DEFAULT, options.cache_pages);
+    try {
+        // DiskCopy 4.2 images are read in place, the disk image starts right after the header
+        size_t disk_part_start = dc42_probe(*infile, nullptr) ? DC42_HEADER_SIZE : 0;
+        if (init_mfs_driver(
+                &fs.state,
+                [](void *disk, void *buf, size_t count, size_t offset) {
+                    ((image *)disk)->read(buf, count, offset);
+                },
+                fs.disk.get(),
+                disk_part_start) != 0) {
+            fprintf(stderr, "Error initializing MFS driver\n");
+            deinit_mfs_driver(&fs.state);
+            return 1;
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "error reading image (%s)\n", e.what());
+        return 1;
+    }
+
+    // decoded once, getattr and lookups never touch the disk
+    for (uint16_t i = 0; i < fs.state.dir_entry_count; i++) {
+        const struct mfs_dir_entry &entry = fs.state.dir_entries[i];
+        std::string name = mfs_host_filename(entry.name, entry.dirent.flNam);
+        if (fs.files.count(name) != 0) {
+            continue;
+        }
+        struct fuse_file &file = fs.files[name];
+        file.dirent = entry.dirent;
+        file.name.assign(entry.name, entry.dirent.flNam);
+        file.forks[0].open = false;
+        file.forks[1].open = false;
+        fs.names.push_back(name);
+    }
+
+    struct fuse_operations ops;
+    memset(&ops, 0, sizeof(ops));
+    ops.init = mfs_fuse_init;
+    ops.getattr = mfs_fuse_getattr;
+    ops.readdir = mfs_fuse_readdir;
+    ops.open = mfs_fuse_open;
+    ops.read = mfs_fuse_read;
+    ops.getxattr = mfs_fuse_getxattr;
+    ops.listxattr = mfs_fuse_listxattr;
+    ops.statfs = mfs_fuse_statfs;
+    fuse_opt_add_arg(&args, "-oro");
+
+    int ret = fuse_main(args.argc, args.argv, &ops, &fs);
+
+    for (auto &it : fs.files) {
+        mfs_close_file(&fs.state, &it.second.forks[0]);
+        mfs_close_file(&fs.state, &it.second.forks[1]);
+    }
+    deinit_mfs_driver(&fs.state);
+    fuse_opt_free_args(&args);
+    return ret;
+}
@@ -1,105 +1,365 @@
+#include <algorithm>
 #include <cinttypes>
 #include <cstdio>
 #include <cstring>
-#include <endianness.h>
-#include <fstream>
-#include <mfs.h>
-#include <mfsro.h>
+#include <fcntl.h>
+#include <mactools/diskcopy42.h>
+#include <mactools/endian.h>
+#include <mactools/image.h>
+#include <mactools/mfs.h>
+#include <mactools/mfsro.h>
+#include <mactools/mount_cache.h>
+#include <mactools/trace.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
 
 #define SECTOR_SIZE (512)
 
-static void read_file(std::fstream &file, size_t bytes, void *buf) {
-    file.read((char *)buf, bytes);
-    if (!file.good()) {
-        fprintf(stderr, "error reading file (%s)\n", std::strerror(errno));
-        exit(1);
+#define CACHE_PAGE_SIZE (SECTOR_SIZE * 8)
+
+// seconds between the classic Mac OS epoch (1904) and the AppleDouble one (2000)
+#define APPLEDOUBLE_DATE_DIFF (3029529600u)
+
+enum output_format {
+    OUTPUT_RAW,         // data fork only
+    OUTPUT_MACBINARY,   // MacBinary II, both forks and the Finder info in one file
+    OUTPUT_APPLEDOUBLE, // data fork in the output file, everything else in ._ next to it
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options] [MFS image filename] [file in MFS image] [output file]\n", name);
+    fprintf(stderr, "  --verify: check the checksums of DiskCopy 4.2 images\n");
+    fprintf(stderr, "  -f [raw|macbinary|appledouble]: output format, default raw (data fork only)\n");
+    fprintf(stderr, "  -c [bytes]: chunk size for macbinary and appledouble output, default 65536\n");
+    fprintf(stderr, "  -r [chunks]: number of chunks to read ahead, default 4\n");
+    fprintf(stderr, "  --cache [pages]: keep up to this many %d byte pages of the image in memory, for slow backing stores\n", CACHE_PAGE_SIZE);
+    fprintf(stderr, "  --clock: use CLOCK instead of LRU eviction for --cache\n");
+    fprintf(stderr, "  --stats: print I/O counters and phase timings to stderr\n");
+    fprintf(stderr, "  --trace [file]: write the phases as Chrome trace event JSON\n");
+    fprintf(stderr, "  --mount-cache [directory]: keep the volume metadata there, unchanged images are mounted without reading it\n");
+    exit(1);
+}
+
+// CRC-16/XMODEM as used by MacBinary II
+static uint16_t crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) != 0 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
     }
+    return crc;
 }
 
-static bool is_diskcopy42(std::fstream &file) {
-    // test checksum
-    file.seekg(0x52, std::ios_base::beg);
-    uint16_t checksum;
-    read_file(file, sizeof(checksum), &checksum);
-    if (swap_be(checksum) != 0x0100) {
-        return false;
+static bool write_chunk(void *user, const void *data, uint32_t size) {
+    write_all(*(int *)user, data, size);
+    return true;
+}
+
+struct stream_params {
+    std::vector<uint8_t> buf;
+    uint32_t readahead;
+};
+
+// streams a whole fork to fd, returns false if it couldn't be read completely
+static bool stream_fork(struct mfs_driver_state *state, struct mfs_file_handle *file, int fd, struct stream_params &params) {
+    uint32_t size = mfs_seek(state, file, 0, MFS_SEEK_END);
+    mfs_seek(state, file, 0, MFS_SEEK_BEGIN);
+    return mfs_stream(state, file, params.buf.data(), params.buf.size(), params.readahead, write_chunk, &fd) == size;
+}
+
+static void write_padding(int fd, size_t size, size_t align) {
+    static const uint8_t zero[128] = {0};
+    if ((size % align) != 0) {
+        write_all(fd, zero, align - (size % align));
     }
+}
+
+static bool write_macbinary(struct mfs_driver_state *state,
+                            struct mfs_file_handle *data,
+                            struct mfs_file_handle *rsrc,
+                            const char *name,
+                            int fd,
+                            struct stream_params &params) {
+    const struct mfs_dirent &dirent = data->dirent;
+    uint8_t header[128] = {0};
+    size_t name_len = std::min(strlen(name), (size_t)63);
+    header[1] = name_len;
+    memcpy(&header[2], name, name_len);
+    // Finder info: type, creator, flags, location, folder
+    memcpy(&header[65], &dirent.flUsrWds[0], 8);
+    header[73] = dirent.flUsrWds[8];
+    memcpy(&header[75], &dirent.flUsrWds[10], 6);
+    header[81] = (dirent.flFlags & MFS_DIRENT_FLAGS_LOCKED) != 0 ? 1 : 0;
+    store_be<uint32_t>(&header[83], mfs_seek(state, data, 0, MFS_SEEK_END));
+    store_be<uint32_t>(&header[87], mfs_seek(state, rsrc, 0, MFS_SEEK_END));
+    store_be<uint32_t>(&header[91], dirent.flCrDat);
+    store_be<uint32_t>(&header[95], dirent.flMdDat);
+    header[101] = dirent.flUsrWds[9];
+    header[122] = 129;
+    header[123] = 129;
+    store_be<uint16_t>(&header[124], crc16(header, 124));
+    write_all(fd, header, sizeof(header));
 
-    // test size
-    uint32_t dsize, tsize;
-    file.seekg(0x40, std::ios_base::beg);
-    read_file(file, sizeof(dsize), &dsize);
-    read_file(file, sizeof(tsize), &tsize);
-    // 0x54 is the size of the Apple Disk Copy 4.2 header
-    if ((swap_be(dsize) + swap_be(tsize) + 0x54) != file.seekg(0, std::ios_base::end).tellg()) {
+    if (!stream_fork(state, data, fd, params)) {
         return false;
     }
-
+    write_padding(fd, data->seekpos, 128);
+    if (!stream_fork(state, rsrc, fd, params)) {
+        return false;
+    }
+    write_padding(fd, rsrc->seekpos, 128);
     return true;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s [MFS image filename] [file in MFS image] [output file]\n", argv[0]);
-        exit(1);
-    }
-    static std::fstream infile = std::fstream(argv[1], std::ios::in | std::ios::binary);
-    if (!infile.is_open()) {
-        fprintf(stderr, "Failed to open input file (%s)\n", std::strerror(errno));
-        exit(1);
+static bool write_appledouble(struct mfs_driver_state *state,
+                              struct mfs_file_handle *data,
+                              struct mfs_file_handle *rsrc,
+                              const char *output,
+                              int fd,
+                              struct stream_params &params) {
+    if (!stream_fork(state, data, fd, params)) {
+        return false;
     }
-    if (is_diskcopy42(infile)) {
-        fprintf(stderr, "This may be a Apple DiskCopy 4.2 image! Extract it before using it with this tool.\n");
+
+    std::string path = output;
+    size_t slash = path.rfind('/');
+    path.insert(slash == std::string::npos ? 0 : slash + 1, "._");
+    int header_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (header_fd < 0) {
+        throw std::runtime_error("failed to open " + path + " (" + std::strerror(errno) + ")");
     }
 
-    infile.seekg(SECTOR_SIZE * 2, std::ios_base::beg); // skip boot blocks
-    struct mfs_mdb mdb;
-    read_file(infile, sizeof(mdb), &mdb);
-    SWAP_MFS_MDB(mdb);
-    if (mdb.drSigWord != MFS_MDB_SIGNATURE) {
-        fprintf(stderr, "Master Directory Block signature mismatch\n");
-    } else {
-        char *name = new char[mdb.drVN + 1];
-        read_file(infile, mdb.drVN, name);
-        name[mdb.drVN] = 0;
-        printf("Volume name: \"%s\"\n", name);
-        delete[] name;
+    const struct mfs_dirent &dirent = data->dirent;
+    // header, 3 entry descriptors, Finder info, file dates
+    uint8_t header[26 + (3 * 12) + 32 + 16] = {0};
+    store_be<uint32_t>(&header[0], 0x00051607);
+    store_be<uint32_t>(&header[4], 0x00020000);
+    store_be<uint16_t>(&header[24], 3);
+    uint8_t *entry = &header[26];
+    size_t offset = 26 + (3 * 12);
+    // Finder info
+    store_be<uint32_t>(&entry[0], 9);
+    store_be<uint32_t>(&entry[4], offset);
+    store_be<uint32_t>(&entry[8], 32);
+    memcpy(&header[offset], dirent.flUsrWds, sizeof(dirent.flUsrWds));
+    offset += 32;
+    // file dates: creation, modification, backup, access
+    store_be<uint32_t>(&entry[12], 8);
+    store_be<uint32_t>(&entry[16], offset);
+    store_be<uint32_t>(&entry[20], 16);
+    store_be<uint32_t>(&header[offset], dirent.flCrDat - APPLEDOUBLE_DATE_DIFF);
+    store_be<uint32_t>(&header[offset + 4], dirent.flMdDat - APPLEDOUBLE_DATE_DIFF);
+    store_be<uint32_t>(&header[offset + 8], 0x80000000);
+    store_be<uint32_t>(&header[offset + 12], 0x80000000);
+    offset += 16;
+    // resource fork
+    store_be<uint32_t>(&entry[24], 2);
+    store_be<uint32_t>(&entry[28], offset);
+    store_be<uint32_t>(&entry[32], mfs_seek(state, rsrc, 0, MFS_SEEK_END));
+
+    bool ok;
+    try {
+        write_all(header_fd, header, sizeof(header));
+        ok = stream_fork(state, rsrc, header_fd, params);
+    } catch (...) {
+        close(header_fd);
+        throw;
     }
+    close(header_fd);
+    return ok;
+}
 
-    struct mfs_driver_state state;
-    if (init_mfs_driver(
-            &state,
-            [](void *buf, size_t count, size_t offset) {
-                infile.seekg(offset, std::ios_base::beg);
-                read_file(infile, count, buf);
-            },
-            0x0) != 0) {
-        fprintf(stderr, "Error initializing MFS driver\n");
-        exit(1);
+int main(int argc, char *argv[]) {
+    bool verify = false;
+    enum output_format format = OUTPUT_RAW;
+    struct stream_params params;
+    size_t chunk_size = 64 * 1024;
+    params.readahead = 4;
+    size_t cache_pages = 0;
+    enum cache_policy cache_policy = CACHE_LRU;
+    bool print_io_stats = false;
+    const char *trace_path = nullptr;
+    const char *mount_cache_dir = nullptr;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--verify") == 0) {
+            verify = true;
+        } else if ((strcmp(argv[i], "-f") == 0) && ((i + 1) < argc)) {
+            i++;
+            if (strcmp(argv[i], "raw") == 0) {
+                format = OUTPUT_RAW;
+            } else if (strcmp(argv[i], "macbinary") == 0) {
+                format = OUTPUT_MACBINARY;
+            } else if (strcmp(argv[i], "appledouble") == 0) {
+                format = OUTPUT_APPLEDOUBLE;
+            } else {
+                usage(argv[0]);
+            }
+        } else if ((strcmp(argv[i], "-c") == 0) && ((i + 1) < argc)) {
+            chunk_size = strtoul(argv[++i], nullptr, 10);
+        } else if ((strcmp(argv[i], "-r") == 0) && ((i + 1) < argc)) {
+            params.readahead = strtoul(argv[++i], nullptr, 10);
+        } else if ((strcmp(argv[i], "--cache") == 0) && ((i + 1) < argc)) {
+            cache_pages = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--clock") == 0) {
+            cache_policy = CACHE_CLOCK;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_io_stats = true;
+        } else if ((strcmp(argv[i], "--trace") == 0) && ((i + 1) < argc)) {
+            trace_path = argv[++i];
+        } else if ((strcmp(argv[i], "--mount-cache") == 0) && ((i + 1) < argc)) {
+            mount_cache_dir = argv[++i];
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if ((args.size() != 3) || (chunk_size == 0) || (chunk_size > UINT32_MAX)) {
+        usage(argv[0]);
     }
+    params.buf.resize(chunk_size);
 
-    struct mfs_file_handle file;
-    if (!mfs_open_file(&state, &file, argv[2], false)) {
-        fprintf(stderr, "Error opening file on MFS image\n");
+    std::shared_ptr<image> infile = open_image(args[0]);
+    if (infile == nullptr) {
+        fprintf(stderr, "Failed to open input file (%s)\n", std::strerror(errno));
         exit(1);
     }
-    uint32_t size = mfs_seek(&state, &file, 0, MFS_SEEK_END);
-    printf("File size: %u\n", size);
-    mfs_seek(&state, &file, 0, MFS_SEEK_BEGIN);
-    uint8_t *buf = new uint8_t[size];
-    uint32_t read = mfs_read(&state, &file, buf, size);
-    if (read != size) {
-        fprintf(stderr, "Error reading file\n");
-        exit(1);
+    std::shared_ptr<cached_image> cache;
+    if (cache_pages != 0) {
+        cache = std::make_shared<cached_image>(infile, CACHE_PAGE_SIZE, cache_pages, cache_policy);
+        infile = cache;
     }
-    std::fstream outfile = std::fstream(argv[3], std::ios::out | std::ios::binary);
-    if (!outfile.is_open()) {
-        fprintf(stderr, "Failed to open output file (%s)\n", std::strerror(errno));
+
+    trace_log log;
+    try {
+        std::unique_ptr<trace_span> phase(new trace_span(&log, "mount"));
+        mfs_read_disk_fn read_disk = [](void *disk, void *buf, size_t count, size_t offset) {
+            ((image *)disk)->read(buf, count, offset);
+        };
+        // checksums can only be verified by reading the image
+        struct mount_cache_data cache_data;
+        bool cacheable = (mount_cache_dir != nullptr) && !verify && mount_cache_stat(args[0], cache_data);
+        std::string cache_path = cacheable ? mount_cache_path(mount_cache_dir, args[0]) : std::string();
+        std::shared_ptr<mount_cache> metadata = cacheable ? open_mount_cache(cache_path, args[0]) : nullptr;
+
+        struct mfs_driver_state state;
+        if (metadata != nullptr) {
+            if (metadata->disk_part_start() == DC42_HEADER_SIZE) {
+                printf("Apple DiskCopy 4.2 image\n");
+            }
+            std::string volume_name = metadata->volume_name();
+            printf("Volume name: \"%.*s\"\n", (int)volume_name.size(), volume_name.data());
+            init_mfs_driver_cached(&state, read_disk, infile.get(), *metadata);
+        } else {
+            // DiskCopy 4.2 images are read in place, the disk image starts right after the header
+            size_t disk_part_start = 0;
+            struct dc42_info dc42;
+            if (dc42_probe(*infile, &dc42)) {
+                printf("Apple DiskCopy 4.2 image\n");
+                if (verify && (!dc42_verify_data(*infile, dc42) || !dc42_verify_tags(*infile, dc42))) {
+                    fprintf(stderr, "DiskCopy 4.2 checksum invalid!\n");
+                    exit(1);
+                }
+                disk_part_start = DC42_HEADER_SIZE;
+            }
+
+            struct mfs_mdb mdb;
+            // skip boot blocks
+            const uint8_t *mdb_raw = infile->view(disk_part_start + MFS_MDB_OFFSET, sizeof(mdb) + MFS_VOLUME_NAME_MAX);
+            mfs_mdb_codec::decode(mdb, mdb_raw);
+            if (mdb.drSigWord != MFS_MDB_SIGNATURE) {
+                fprintf(stderr, "Master Directory Block signature mismatch\n");
+            } else {
+                printf("Volume name: \"%.*s\"\n", (int)std::min(mdb.drVN, (uint8_t)MFS_VOLUME_NAME_MAX), (const char *)&mdb_raw[sizeof(mdb)]);
+            }
+
+            if (init_mfs_driver(&state, read_disk, infile.get(), disk_part_start) != 0) {
+                fprintf(stderr, "Error initializing MFS driver\n");
+                exit(1);
+            }
+            if (cacheable) {
+                mfs_fill_mount_cache(&state, cache_data);
+                if (!write_mount_cache(cache_path, cache_data)) {
+                    fprintf(stderr, "Failed to write mount cache (%s)\n", std::strerror(errno));
+                }
+            }
+        }
+        mfs_set_prefetch(&state, [](void *disk, size_t count, size_t offset) {
+            ((image *)disk)->prefetch(offset, count);
+        });
+
+        phase.reset(new trace_span(&log, "open"));
+        struct mfs_file_handle file;
+        if (!mfs_open_file(&state, &file, args[1], false)) {
+            fprintf(stderr, "Error opening file on MFS image\n");
+            exit(1);
+        }
+        uint32_t size = mfs_seek(&state, &file, 0, MFS_SEEK_END);
+        printf("File size: %u\n", size);
+        mfs_seek(&state, &file, 0, MFS_SEEK_BEGIN);
+        int outfd = open(args[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (outfd < 0) {
+            fprintf(stderr, "Failed to open output file (%s)\n", std::strerror(errno));
+            exit(1);
+        }
+
+        phase.reset(new trace_span(&log, "extract"));
+        bool ok = true;
+        // runs copied by the kernel don't go through the driver's read callback
+        struct io_stats copy_stats = {0, 0, 0, 0, 0, 0};
+        if (format == OUTPUT_RAW) {
+            // copy the file one contiguous run at a time, without the data ever passing through a buffer here
+            uint32_t pos = 0;
+            size_t disk_offset;
+            uint32_t run;
+            while ((run = mfs_map(&state, &file, pos, &disk_offset)) != 0) {
+                copy_image_range(*infile, disk_offset, run, outfd);
+                copy_stats.read_calls++;
+                copy_stats.bytes_read += run;
+                pos += run;
+            }
+            ok = pos == size;
+        } else {
+            struct mfs_file_handle rsrc;
+            mfs_open_file(&state, &rsrc, args[1], true);
+            printf("Resource size: %u\n", mfs_seek(&state, &rsrc, 0, MFS_SEEK_END));
+            if (format == OUTPUT_MACBINARY) {
+                ok = write_macbinary(&state, &file, &rsrc, args[1], outfd, params);
+            } else {
+                ok = write_appledouble(&state, &file, &rsrc, args[2], outfd, params);
+            }
+            mfs_close_file(&state, &rsrc);
+        }
+        close(outfd);
+        phase.reset();
+        if (!ok) {
+            fprintf(stderr, "Error reading file\n");
+            unlink(args[2]);
+            exit(1);
+        }
+
+        struct io_stats stats = {state.stats.read_calls, state.stats.bytes_read, state.stats.seeks, state.stats.chain_hops, 0, 0};
+        add_io_stats(stats, copy_stats);
+        if (cache != nullptr) {
+            stats.cache_hits = cache->stats().hits;
+            stats.cache_misses = cache->stats().misses;
+        }
+        mfs_close_file(&state, &file);
+        deinit_mfs_driver(&state);
+        if (print_io_stats) {
+            print_stats(stderr, stats, &log);
+        }
+        if ((trace_path != nullptr) && !log.write_chrome_trace(trace_path)) {
+            fprintf(stderr, "Failed to write trace file (%s)\n", std::strerror(errno));
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "error reading file (%s)\n", e.what());
         exit(1);
     }
-    outfile.write((char *)buf, read);
-    outfile.close();
-    delete[] buf;
 
     return 0;
 }
@@ -0,0 +1,9 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// true for the file extensions images are usually stored with
+bool is_image_filename(const std::string &name);
+
+// collects every image file below path in sorted order, explicitly named files are always taken
+void collect_images(const std::string &path, bool explicit_arg, std::vector<std::string> &images);
@@ -1,19 +1,33 @@
 #pragma once
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <iostream>
+#include <mactools/image.h>
+#include <mactools/mfs.h>
+#include <mactools/mount_cache.h>
+#include <mactools/trace.h>
 #include <memory>
-#include <mfs.h>
 #include <string>
 #include <utility>
 #include <vector>
 
-bool maybe_diskcopy42(std::iostream &stream);
+// mfstools-extract writes resource forks under the data fork's name into this subdirectory of the output directory,
+// mfstools-write looks for them there
+#define RSRC_DIR "rsrc"
 
 class mfs {
 public:
+    mfs();
+    mfs(std::shared_ptr<image> img);
     mfs(std::shared_ptr<std::iostream> stream);
+    // switches to another image, init_readonly has to be called again afterwards; keeps the allocated buffers around for reuse
+    void set_image(std::shared_ptr<image> img);
     bool init_readonly();
+    // instead of init_readonly, takes the metadata from a mount cache and doesn't read the image at all
+    void init_from_cache(const mount_cache &cache);
+    // fills in the volume metadata of data after init_readonly (disk_part_start and the image identification are left alone)
+    void fill_mount_cache(struct mount_cache_data &data);
 
     struct mfs_dirent_abs {
         std::string name;
@@ -22,18 +36,117 @@ public:
         // unix timestamps
         int64_t ctime;
         int64_t mtime;
+        uint32_t file_number;
+        uint16_t start_block; // first allocation block of the data fork
+        uint16_t rsrc_start_block;
+        size_t physical_size; // allocated to the data fork
+        size_t rsrc_physical_size;
+        uint8_t finder_info[16]; // flUsrWds: type, creator, Finder flags, location and folder
+        bool locked;
+    };
+
+    // a run of contiguous allocation blocks belonging to a fork
+    struct mfs_extent {
+        size_t file_offset;   // offset of the run within the fork
+        uint16_t start_block; // first allocation block of the run
+        uint16_t block_count; // number of allocation blocks in the run
+    };
+
+    struct mfs_fragmentation {
+        size_t forks;            // non-empty forks
+        size_t fragmented_forks; // forks made of more than one run
+        size_t extents;          // runs making up all forks
+        size_t free_blocks;
+        size_t free_runs;
+        size_t largest_free_run; // in allocation blocks
     };
 
     std::vector<struct mfs_dirent_abs> readdir();
+    // returns false if there is no file with this name
+    bool stat(const std::string &name, struct mfs_dirent_abs &dirent);
+    // returns the allocation chain of a fork, empty if there is no file with this name or the fork is empty
+    std::vector<struct mfs_extent> extents(const std::string &name, bool resource_fork);
+    // reads up to count bytes at offset from a fork, returns the amount of bytes read
+    // may be called from multiple threads at once if the image supports it
+    size_t read(const std::string &name, bool resource_fork, void *buf, size_t count, size_t offset);
+    // writes a whole fork to out_fd, contiguous runs are copied by the kernel where possible; returns the amount of bytes written
+    size_t copy_to(const std::string &name, bool resource_fork, int out_fd);
+
+    // write support, needs a writable image
+    // fork data is written right away, directory, allocation block map and MDB changes stay in memory until flush(); blocks freed
+    // in a batch aren't reused before it is flushed, so an interrupted batch never overwrites data the directory on disk still
+    // points to
+
+    // adds a file or replaces both forks of an existing one (keeping its file number, creation date and Finder info)
+    // throws std::runtime_error if it doesn't fit on the volume or into the directory
+    void write_file(const std::string &name, const void *data, size_t data_size, const void *rsrc, size_t rsrc_size, int64_t mtime);
+    // returns false if there is no file with this name
+    bool remove(const std::string &name);
+    // number of allocation blocks available to write_file() until the next flush()
+    size_t free_blocks();
+    // writes the allocation block map, directory and MDB if anything changed
+    // these are separate writes: if interrupted after the map, blocks of replaced or deleted files are already marked free while
+    // the directory on disk still points to them, work on a copy (copy_image_file) where that matters
+    void flush();
+
+    struct mfs_fragmentation fragmentation();
+
+    // I/O counters since construction, cache counters are those of the current image if it is a cached_image
+    struct io_stats stats() const;
+    // records the phases of init_readonly in log, nullptr to stop; the log has to outlive this instance
+    void set_trace(trace_log *log);
+    // rewrites the volume so every fork is a single run, in directory order and without preallocated blocks, then flushes
+    // all forks are read into memory first since they move over each other; not safe to interrupt, mfstools-defrag runs it on a copy
+    void defragment();
 
 private:
-    void read_stream(void *buf, size_t bytes);
     void read_stream(void *buf, size_t bytes, size_t offset);
+    const uint8_t *view(size_t offset, size_t count);
+    void count_read(size_t count, size_t offset);
 
+    void load_alloc_block_map();
     uint16_t get_alloc_block_map_value(uint16_t index);
 
-    std::vector<std::pair<struct mfs_dirent, std::string>> readdir_int();
+    struct mfs_dirent_int {
+        struct mfs_dirent dirent;
+        std::string name;
+        std::vector<struct mfs_extent> extents[2]; // data and resource fork
+    };
+
+    size_t extent_disk_offset(const struct mfs_extent &extent);
+    std::vector<struct mfs_extent> build_extents(const struct mfs_dirent &dirent, bool resource_fork);
+    void load_directory();
+    void build_dirent_hash();
+    struct mfs_dirent_int *find_dirent(const std::string &name);
+
+    bool block_allocatable(size_t index);
+    std::vector<struct mfs_extent> allocate(size_t block_count);
+    void free_extents(const std::vector<struct mfs_extent> &extents);
+    void write_extents(const std::vector<struct mfs_extent> &extents, const void *buf, size_t size);
+    size_t directory_size(size_t extra_name_len);
+    void store_alloc_block_map();
+    void store_directory();
 
-    std::shared_ptr<std::iostream> _stream;
+    std::shared_ptr<image> _image;
     struct mfs_mdb _mdb;
+    std::vector<uint16_t> _alloc_map; // decoded allocation block map, entry n belongs to allocation block n + 2
+    std::vector<struct mfs_dirent_int> _dirents;
+    std::vector<size_t> _dirent_hash; // name index into _dirents (index + 1, 0 -> empty slot)
+    std::vector<bool> _freed_blocks;  // map entries freed since the last flush, not allocatable until then
+    bool _dirty;                      // metadata changed since the last flush
+
+    // counters are atomic since read() and copy_to() may run on multiple threads
+    std::atomic<uint64_t> _read_calls;
+    std::atomic<uint64_t> _bytes_read;
+    std::atomic<uint64_t> _seeks;
+    std::atomic<uint64_t> _chain_hops;
+    std::atomic<size_t> _next_offset; // where the previous read ended
+    trace_log *_trace;
 };
+
+// parses a thread count from the command line, returns false for anything but a positive decimal number
+bool parse_thread_count(const char *arg, unsigned int &count);
+
+// copies the image file src to dst (created with the permissions of src), for tools that change a copy instead of the original
+// throws std::runtime_error on errors
+void copy_image_file(const char *src, const char *dst);
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mactools/image.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// on-disk index of fork hashes across many images, laid out so it can be used straight from a read-only mapping:
+// header, image table, entry table sorted by (hash, size) and a string table with image paths and file names
+// everything is in host byte order and aligned to 8 bytes, indexes aren't portable between architectures
+
+#define DEDUP_INDEX_MAGIC      "MFSDEDUP"
+#define DEDUP_INDEX_VERSION    (1)
+#define DEDUP_INDEX_BYTE_ORDER (0x01020304)
+
+struct dedup_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; // DEDUP_INDEX_BYTE_ORDER as written by the host that built the index
+    uint64_t image_count;
+    uint64_t entry_count;
+    uint64_t images_offset;
+    uint64_t entries_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+struct dedup_image_record {
+    uint64_t path_offset; // into the string table
+    uint32_t path_length;
+    uint32_t fork_count;
+    uint64_t size; // of the image file when it was hashed, a re-run only reads it again if size or mtime changed
+    int64_t mtime_ns;
+};
+
+struct dedup_entry {
+    uint64_t hash; // XXH64 of the fork
+    uint32_t size; // fork length, part of the key so a hash collision also needs equal sizes
+    uint32_t image;
+    uint32_t name_offset; // into the string table
+    uint8_t name_length;
+    uint8_t resource_fork;
+    uint16_t reserved;
+};
+
+// read-only view of an index file
+class dedup_index {
+public:
+    // throws std::runtime_error if the file can't be opened or isn't a valid index
+    dedup_index(const char *path);
+
+    size_t image_count() const;
+    const struct dedup_image_record &image(size_t index) const;
+    std::string image_path(size_t index) const;
+
+    size_t entry_count() const;
+    const struct dedup_entry &entry(size_t index) const;
+    std::string name(const struct dedup_entry &entry) const;
+    // range of entries with this hash and size
+    std::pair<const struct dedup_entry *, const struct dedup_entry *> find(uint64_t hash, uint32_t size) const;
+
+private:
+    std::shared_ptr<::image> _file;
+    const struct dedup_index_header *_header;
+    const struct dedup_image_record *_images;
+    const struct dedup_entry *_entries;
+    const char *_strings;
+};
+
+// collects images and their forks and writes a new index
+class dedup_index_writer {
+public:
+    // returns the image number for add_fork
+    uint32_t add_image(const std::string &path, uint64_t size, int64_t mtime_ns);
+    void add_fork(uint32_t image, const std::string &name, bool resource_fork, uint64_t hash, uint32_t size);
+
+    // written to a temporary file that replaces path once complete, so readers never see a partial index
+    // throws std::runtime_error on errors
+    void write(const char *path);
+
+private:
+    struct fork {
+        uint64_t hash;
+        uint32_t size;
+        uint32_t image;
+        std::string name;
+        bool resource_fork;
+    };
+    struct image_info {
+        std::string path;
+        uint64_t size;
+        int64_t mtime_ns;
+        uint32_t fork_count;
+    };
+    std::vector<struct image_info> _images;
+    std::vector<struct fork> _forks;
+};
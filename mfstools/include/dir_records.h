@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+
+// records written by mfstools-dir -f binary, packed and in host byte order:
+// one dir_stream_header, then for every image a dir_image_record followed by a dir_file_record for each of its files
+// every record starts with its size including the path or name following it, so readers can skip kinds they don't know
+
+#define DIR_STREAM_MAGIC      "MFSDIR\0\0"
+#define DIR_STREAM_VERSION    (1)
+#define DIR_STREAM_BYTE_ORDER (0x01020304)
+
+#define DIR_RECORD_IMAGE (1)
+#define DIR_RECORD_FILE  (2)
+
+#define DIR_FILE_LOCKED (1 << 0)
+
+struct __attribute__((packed)) dir_stream_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; // DIR_STREAM_BYTE_ORDER as written by the host
+};
+
+struct __attribute__((packed)) dir_image_record {
+    uint32_t size;
+    uint32_t kind;  // DIR_RECORD_IMAGE
+    uint32_t image; // position in the listing, starting at 0
+    uint32_t file_count;
+    // path follows, not null terminated
+};
+
+struct __attribute__((packed)) dir_file_record {
+    uint32_t size;
+    uint32_t kind;  // DIR_RECORD_FILE
+    uint32_t image; // of the preceding dir_image_record
+    uint32_t file_number;
+    uint32_t data_size;
+    uint32_t data_physical_size;
+    uint32_t rsrc_size;
+    uint32_t rsrc_physical_size;
+    uint16_t data_start_block;
+    uint16_t rsrc_start_block;
+    // unix timestamps
+    int64_t ctime;
+    int64_t mtime;
+    char type[4];
+    char creator[4];
+    uint16_t finder_flags;
+    uint8_t flags; // DIR_FILE_LOCKED
+    uint8_t name_length;
+    // Mac OS Roman name follows, not null terminated
+};
@@ -0,0 +1,7 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+// runs fn(worker, task) for every task in [0, task_count) using thread_count threads
+// tasks are dealt out round-robin to per-thread queues, a thread that runs out of work steals from the back of the other queues
+void run_work_stealing(size_t task_count, unsigned int thread_count, const std::function<void(unsigned int worker, size_t task)> &fn);
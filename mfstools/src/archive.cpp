@@ -0,0 +1,44 @@
+#include <algorithm>
+#include <archive.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+bool is_image_filename(const std::string &name) {
+    static const char *extensions[] = {".img", ".image", ".dc42", ".dsk"};
+    for (const char *ext : extensions) {
+        size_t len = strlen(ext);
+        if ((name.size() > len) && (strcasecmp(name.c_str() + name.size() - len, ext) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void collect_images(const std::string &path, bool explicit_arg, std::vector<std::string> &images) {
+    struct stat st;
+    if ((stat(path.c_str(), &st) == 0) && S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path.c_str());
+        if (dir == nullptr) {
+            fprintf(stderr, "Failed to open directory %s (%s)\n", path.c_str(), std::strerror(errno));
+            return;
+        }
+        std::vector<std::string> entries;
+        struct dirent *de;
+        while ((de = readdir(dir)) != nullptr) {
+            if ((strcmp(de->d_name, ".") != 0) && (strcmp(de->d_name, "..") != 0)) {
+                entries.push_back(path + "/" + de->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(entries.begin(), entries.end());
+        for (const auto &e : entries) {
+            collect_images(e, false, images);
+        }
+    } else if (explicit_arg || is_image_filename(path)) {
+        images.push_back(path);
+    }
+}
@@ -1,11 +1,21 @@
 #include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <common.h>
-#include <endianness.h>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
 #include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <utility>
 
 #define SECTOR_SIZE (512)
 
+#define STREAM_CACHE_PAGE_SIZE  (SECTOR_SIZE * 8)
+#define STREAM_CACHE_PAGE_COUNT (256)
+
 static int64_t mactime2unix(uint32_t mactime) {
     int64_t diff = (int64_t)(60 * 60 * 24) * ((365 * (1970 - 1904)) + (((1970 - 1904) / 4) + 1));
     return (int64_t)mactime - diff;
@@ -23,129 +33,158 @@ static uint32_t unixtime2mac(int64_t unixtime) {
     return (uint32_t)mtime;
 }
 
-static void read_stream(std::iostream &stream, size_t bytes, void *buf) {
-    stream.read((char *)buf, bytes);
-    if (!stream.good()) {
-        throw std::runtime_error("failed to read from input stream");
+void mfs::count_read(size_t count, size_t offset) {
+    _read_calls++;
+    _bytes_read += count;
+    if (_next_offset.exchange(offset + count) != offset) {
+        _seeks++;
     }
 }
 
-bool maybe_diskcopy42(std::iostream &stream) {
-    // test checksum
-    stream.seekg(0x52, std::ios_base::beg);
-    uint16_t checksum;
-    read_stream(stream, sizeof(checksum), &checksum);
-    if (swap_be(checksum) != 0x0100) {
-        return false;
-    }
+void mfs::read_stream(void *buf, size_t bytes, size_t offset) {
+    count_read(bytes, offset);
+    _image.get()->read(buf, bytes, offset);
+}
 
-    // test size
-    uint32_t dsize, tsize;
-    stream.seekg(0x40, std::ios_base::beg);
-    read_stream(stream, sizeof(dsize), &dsize);
-    read_stream(stream, sizeof(tsize), &tsize);
-    // 0x54 is the size of the Apple Disk Copy 4.2 header
-    if ((swap_be(dsize) + swap_be(tsize) + 0x54) != stream.seekg(0, std::ios_base::end).tellg()) {
-        return false;
-    }
+const uint8_t *mfs::view(size_t offset, size_t count) {
+    count_read(count, offset);
+    return _image.get()->view(offset, count);
+}
 
-    return true;
+void mfs::load_alloc_block_map() {
+    size_t count = _mdb.drNmAlBlks;
+    const uint8_t *packed = view(MFS_ALLOC_BLOCK_MAP_OFFSET, mfs_alloc_block_map_size(count));
+    _alloc_map.resize(count);
+    mfs_unpack_alloc_block_map(packed, count, _alloc_map.data());
 }
 
-static bool mfs_namecmp(const char *mfs_name, const char *c_str, size_t mfs_name_len) {
-    size_t i;
-    for (i = 0; (i < mfs_name_len) && (*c_str != '\0'); i++) {
-        if (mfs_name[i] != *c_str++) {
-            return false;
-        }
+uint16_t mfs::get_alloc_block_map_value(uint16_t index) {
+    index &= 0xFFF;
+    if ((index < 2) || (index >= (_alloc_map.size() + 2))) {
+        return MFS_ALLOC_BLOCK_MAP_FREE;
     }
-    return *c_str == '\0' && i == mfs_name_len;
+    return _alloc_map[index - 2];
 }
 
-void mfs::read_stream(void *buf, size_t bytes) {
-    _stream.get()->read((char *)buf, bytes);
-    if (!_stream.get()->good()) {
-        throw std::runtime_error("failed to read from input stream");
-    }
+size_t mfs::extent_disk_offset(const struct mfs_extent &extent) {
+    return mfs_alloc_block_offset(_mdb, extent.start_block);
 }
 
-void mfs::read_stream(void *buf, size_t bytes, size_t offset) {
-    _stream.get()->seekg(offset, std::ios_base::beg);
-    _stream.get()->read((char *)buf, bytes);
-    if (!_stream.get()->good()) {
-        throw std::runtime_error("failed to read from input stream");
+std::vector<struct mfs::mfs_extent> mfs::build_extents(const struct mfs_dirent &dirent, bool resource_fork) {
+    std::vector<struct mfs_extent> ret;
+    uint16_t current_block = resource_fork ? dirent.flRStBlk : dirent.flStBlk;
+    size_t file_size = resource_fork ? std::min(dirent.flRLgLen, dirent.flRPyLen) : std::min(dirent.flLgLen, dirent.flPyLen);
+    // a valid chain can never be longer than the volume
+    size_t block_count = std::min((file_size + (_mdb.drAlBlkSiz - 1)) / _mdb.drAlBlkSiz, (size_t)_mdb.drNmAlBlks);
+
+    for (size_t i = 0; i < block_count; i++) {
+        if ((current_block < 2) || (current_block == MFS_ALLOC_BLOCK_MAP_DIRENTS) || (current_block >= (_mdb.drNmAlBlks + 2))) {
+            break;
+        }
+        if (ret.empty() || (current_block != (ret.back().start_block + ret.back().block_count))) {
+            ret.push_back({i * _mdb.drAlBlkSiz, current_block, 0});
+        }
+        ret.back().block_count++;
+        current_block = get_alloc_block_map_value(current_block);
+        _chain_hops++;
     }
+    return ret;
 }
 
-uint16_t mfs::get_alloc_block_map_value(uint16_t index) {
-    size_t allocation_block_map_start = (SECTOR_SIZE * 2) + sizeof(struct mfs_mdb) + 27;
+void mfs::load_directory() {
+    size_t directory_size = (size_t)_mdb.drBlLen * SECTOR_SIZE;
+    const uint8_t *directory = view((size_t)_mdb.drDirSt * SECTOR_SIZE, directory_size);
 
-    index &= 0xFFF;
-    index -= 2;
-    size_t allocmap_byte_offset = index + (index / 2); // * 1.5
-    uint16_t value;
-    read_stream(&value, sizeof(value), allocation_block_map_start + allocmap_byte_offset);
-    value = swap_be(value);
-    // value = (index & 0x01) != 0 ? value >> 4 : value & 0xFFF;
-    value = (index & 0x01) != 0 ? value & 0xFFF : value >> 4;
-    return value;
-}
-
-std::vector<std::pair<struct mfs_dirent, std::string>> mfs::readdir_int() {
-    std::vector<std::pair<struct mfs_dirent, std::string>> ret;
-    size_t directory_start = (size_t)_mdb.drDirSt * SECTOR_SIZE;
-    char *fname_buf = new char[256];
-    uint32_t offset = 0;
+    size_t offset = 0;
     struct mfs_dirent dirent;
-    for (uint16_t i = 0; i < _mdb.drNmFls; i++) {
-        read_stream(&dirent, sizeof(dirent), directory_start + offset);
-        SWAP_MFS_DIRENT(dirent);
-
-        if (((dirent.flFlags & MFS_DIRENT_FLAGS_USED) != 0) && (dirent.flLgLen <= dirent.flPyLen) && (dirent.flRLgLen <= dirent.flRPyLen) &&
-            (dirent.flNam > 0) && (dirent.flType == 0)) {
-            ret.push_back({dirent, ""});
-            read_stream(fname_buf, dirent.flNam, directory_start + offset + sizeof(struct mfs_dirent));
-            ret.back().second.assign(&fname_buf[0], &fname_buf[dirent.flNam]);
+    const char *name;
+    for (uint16_t i = 0; (i < _mdb.drNmFls) && mfs_next_dirent(directory, directory_size, &offset, &dirent, &name); i++) {
+        if (mfs_dirent_valid(dirent)) {
+            _dirents.push_back({dirent, std::string(name, dirent.flNam), {build_extents(dirent, false), build_extents(dirent, true)}});
         }
+    }
 
-        // dirents are always aligned to 2-byte boundary
-        if ((directory_start + offset + sizeof(struct mfs_dirent) + dirent.flNam) % 2 != 0) {
-            offset++;
-        }
+    build_dirent_hash();
+}
 
-        // donno any other solution rn
-        uint8_t term;
-        do {
-            read_stream(&term, 1, directory_start + offset + sizeof(struct mfs_dirent) + dirent.flNam);
-            if (term == 0) {
-                offset++;
-            }
-        } while (term == 0);
+void mfs::build_dirent_hash() {
+    // open addressing with linear probing, slots hold entry index + 1 so zero means empty
+    size_t hash_size = 1;
+    while (hash_size < (_dirents.size() * 2)) {
+        hash_size <<= 1;
+    }
+    _dirent_hash.assign(hash_size, 0);
+    for (size_t i = 0; i < _dirents.size(); i++) {
+        size_t slot = std::hash<std::string>()(_dirents[i].name) & (hash_size - 1);
+        while (_dirent_hash[slot] != 0) {
+            slot = (slot + 1) & (hash_size - 1);
+        }
+        _dirent_hash[slot] = i + 1;
+    }
+}
 
-        offset += sizeof(struct mfs_dirent) + (size_t)dirent.flNam;
+struct mfs::mfs_dirent_int *mfs::find_dirent(const std::string &name) {
+    if (_dirent_hash.empty()) {
+        return nullptr;
     }
-    delete[] fname_buf;
-    return ret;
+    size_t slot = std::hash<std::string>()(name) & (_dirent_hash.size() - 1);
+    while (_dirent_hash[slot] != 0) {
+        struct mfs_dirent_int *entry = &_dirents[_dirent_hash[slot] - 1];
+        if (entry->name == name) {
+            return entry;
+        }
+        slot = (slot + 1) & (_dirent_hash.size() - 1);
+    }
+    return nullptr;
 }
 
-mfs::mfs(std::shared_ptr<std::iostream> stream) {
+mfs::mfs() {
     static_assert(sizeof(size_t) >= sizeof(uint32_t), "size_t must be at least 32-bits wide");
-    _stream = stream;
+    _dirty = false;
+    _read_calls = 0;
+    _bytes_read = 0;
+    _seeks = 0;
+    _chain_hops = 0;
+    _next_offset = 0;
+    _trace = nullptr;
+}
+
+mfs::mfs(std::shared_ptr<image> img) : mfs() {
+    _image = img;
+}
+
+// every stream access is a seek and a read, so stream backed volumes get a small page cache
+mfs::mfs(std::shared_ptr<std::iostream> stream)
+    : mfs(std::make_shared<cached_image>(std::make_shared<stream_image>(stream), STREAM_CACHE_PAGE_SIZE, STREAM_CACHE_PAGE_COUNT)) {}
+
+void mfs::set_image(std::shared_ptr<image> img) {
+    _image = img;
 }
 
 bool mfs::init_readonly() {
-    read_stream(&_mdb, sizeof(_mdb), SECTOR_SIZE * 2);
-    SWAP_MFS_MDB(_mdb);
+    _alloc_map.clear();
+    _dirents.clear();
+    _dirent_hash.clear();
+    _dirty = false;
+
+    uint8_t mdb_raw[sizeof(struct mfs_mdb)];
+    read_stream(mdb_raw, sizeof(mdb_raw), MFS_MDB_OFFSET);
+    mfs_mdb_codec::decode(_mdb, mdb_raw);
     if (_mdb.drSigWord != MFS_MDB_SIGNATURE) {
         return false;
     }
 
     // sanity checks
-    if ((_mdb.drAlBlkSiz == 0) || (_mdb.drAlBlkSiz % SECTOR_SIZE != 0) || (_mdb.drClpSiz == 0) || (_mdb.drClpSiz % _mdb.drAlBlkSiz != 0) ||
-        (_mdb.drFreeBks > _mdb.drNmAlBlks) || ((_mdb.drBlLen * SECTOR_SIZE) < (_mdb.drNmFls * sizeof(struct mfs_dirent)))) {
+    if (!mfs_mdb_valid(_mdb)) {
         return false;
     }
 
+    {
+        trace_span span(_trace, "allocation block map");
+        load_alloc_block_map();
+    }
+    _freed_blocks.assign(_alloc_map.size(), false);
+
     uint16_t dirent_block_count = 0;
     int state = 0;
     for (uint16_t i = 2; i < (_mdb.drNmAlBlks + 2); i++) {
@@ -162,13 +201,516 @@ bool mfs::init_readonly() {
     }
     // TODO: more sanity checks on dirent_block_count
 
+    trace_span span(_trace, "directory scan");
+    load_directory();
+
     return true;
 }
 
+void mfs::init_from_cache(const mount_cache &cache) {
+    _mdb = cache.mdb();
+    _alloc_map.assign(cache.alloc_map(), cache.alloc_map() + _mdb.drNmAlBlks);
+    _freed_blocks.assign(_alloc_map.size(), false);
+    _dirents.clear();
+    _dirty = false;
+    for (size_t i = 0; i < cache.file_count(); i++) {
+        const struct mount_cache_file &f = cache.file(i);
+        struct mfs_dirent_int e = {f.dirent, std::string(cache.name(i), f.dirent.flNam), {}};
+        for (int fork = 0; fork < 2; fork++) {
+            const struct ::mfs_extent *extents = cache.extents(i, fork != 0);
+            for (uint16_t x = 0; x < f.extent_count[fork]; x++) {
+                e.extents[fork].push_back({extents[x].file_offset, extents[x].start_block, extents[x].block_count});
+            }
+        }
+        _dirents.push_back(std::move(e));
+    }
+    build_dirent_hash();
+}
+
+void mfs::fill_mount_cache(struct mount_cache_data &data) {
+    data.mdb = _mdb;
+    char volume_name[MFS_VOLUME_NAME_MAX];
+    read_stream(volume_name, sizeof(volume_name), MFS_MDB_OFFSET + sizeof(struct mfs_mdb));
+    data.volume_name.assign(volume_name, std::min((size_t)_mdb.drVN, sizeof(volume_name)));
+    data.alloc_map = _alloc_map;
+    data.files.clear();
+    data.extents.clear();
+    data.names.clear();
+    for (const auto &e : _dirents) {
+        struct mount_cache_file f;
+        memset(&f, 0, sizeof(f));
+        f.dirent = e.dirent;
+        f.name_offset = data.names.size();
+        f.first_extent = data.extents.size();
+        data.names += e.name;
+        for (int fork = 0; fork < 2; fork++) {
+            for (const auto &x : e.extents[fork]) {
+                data.extents.push_back({(uint32_t)x.file_offset, x.start_block, x.block_count});
+            }
+            f.extent_count[fork] = e.extents[fork].size();
+        }
+        data.files.push_back(f);
+    }
+}
+
+static struct mfs::mfs_dirent_abs mfs_dirent_abs_from(const struct mfs_dirent &dirent, const std::string &name) {
+    struct mfs::mfs_dirent_abs ret = {name,
+                                      dirent.flLgLen,
+                                      dirent.flRLgLen,
+                                      mactime2unix(dirent.flCrDat),
+                                      mactime2unix(dirent.flMdDat),
+                                      dirent.flFlNum,
+                                      dirent.flStBlk,
+                                      dirent.flRStBlk,
+                                      dirent.flPyLen,
+                                      dirent.flRPyLen,
+                                      {},
+                                      (dirent.flFlags & MFS_DIRENT_FLAGS_LOCKED) != 0};
+    memcpy(ret.finder_info, dirent.flUsrWds, sizeof(ret.finder_info));
+    return ret;
+}
+
 std::vector<struct mfs::mfs_dirent_abs> mfs::readdir() {
     std::vector<struct mfs::mfs_dirent_abs> ret;
-    for (auto e : readdir_int()) {
-        ret.push_back({e.second, e.first.flLgLen, e.first.flRLgLen, mactime2unix(e.first.flCrDat), mactime2unix(e.first.flMdDat)});
+    for (const auto &e : _dirents) {
+        ret.push_back(mfs_dirent_abs_from(e.dirent, e.name));
+    }
+    return ret;
+}
+
+bool mfs::stat(const std::string &name, struct mfs_dirent_abs &dirent) {
+    const struct mfs_dirent_int *e = find_dirent(name);
+    if (e == nullptr) {
+        return false;
+    }
+    dirent = mfs_dirent_abs_from(e->dirent, e->name);
+    return true;
+}
+
+std::vector<struct mfs::mfs_extent> mfs::extents(const std::string &name, bool resource_fork) {
+    const struct mfs_dirent_int *e = find_dirent(name);
+    if (e == nullptr) {
+        return {};
+    }
+    return e->extents[resource_fork ? 1 : 0];
+}
+
+size_t mfs::read(const std::string &name, bool resource_fork, void *buf, size_t count, size_t offset) {
+    const struct mfs_dirent_int *e = find_dirent(name);
+    if (e == nullptr) {
+        return 0;
+    }
+    const std::vector<struct mfs_extent> &extents = e->extents[resource_fork ? 1 : 0];
+    size_t file_size = resource_fork ? e->dirent.flRLgLen : e->dirent.flLgLen;
+    if (offset >= file_size) {
+        return 0;
+    }
+    count = std::min(count, file_size - offset);
+
+    // first extent that starts after offset, the one before it contains offset
+    auto it = std::upper_bound(
+        extents.begin(), extents.end(), offset, [](size_t offset, const struct mfs_extent &extent) { return offset < extent.file_offset; });
+    if (it == extents.begin()) {
+        return 0;
+    }
+    size_t done = 0;
+    for (--it; (it != extents.end()) && (done != count); ++it) {
+        size_t extent_offset = offset + done - it->file_offset;
+        size_t extent_size = (size_t)it->block_count * _mdb.drAlBlkSiz;
+        if (extent_offset >= extent_size) {
+            // chain ended before the file did
+            break;
+        }
+        size_t amount = std::min(count - done, extent_size - extent_offset);
+        read_stream((uint8_t *)buf + done, amount, extent_disk_offset(*it) + extent_offset);
+        done += amount;
+    }
+    return done;
+}
+
+size_t mfs::copy_to(const std::string &name, bool resource_fork, int out_fd) {
+    const struct mfs_dirent_int *e = find_dirent(name);
+    if (e == nullptr) {
+        return 0;
+    }
+    size_t file_size = resource_fork ? e->dirent.flRLgLen : e->dirent.flLgLen;
+    size_t done = 0;
+    for (const auto &extent : e->extents[resource_fork ? 1 : 0]) {
+        if (done == file_size) {
+            break;
+        }
+        size_t amount = std::min((size_t)extent.block_count * _mdb.drAlBlkSiz, file_size - done);
+        count_read(amount, extent_disk_offset(extent));
+        copy_image_range(*_image.get(), extent_disk_offset(extent), amount, out_fd);
+        done += amount;
+    }
+    return done;
+}
+
+// size of a directory entry including its name, entries are 2-byte aligned
+static size_t dirent_size(size_t name_len) {
+    size_t size = sizeof(struct mfs_dirent) + name_len;
+    return size + (size % 2);
+}
+
+bool mfs::block_allocatable(size_t index) {
+    return (_alloc_map[index] == MFS_ALLOC_BLOCK_MAP_FREE) && !_freed_blocks[index];
+}
+
+std::vector<struct mfs::mfs_extent> mfs::allocate(size_t block_count) {
+    // free runs as (first map index, length)
+    std::vector<std::pair<size_t, size_t>> runs;
+    for (size_t i = 0; i < _alloc_map.size();) {
+        if (!block_allocatable(i)) {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while ((i < _alloc_map.size()) && block_allocatable(i)) {
+            i++;
+        }
+        runs.push_back({start, i - start});
+    }
+
+    std::vector<struct mfs_extent> ret;
+    size_t done = 0;
+    while (done < block_count) {
+        size_t needed = block_count - done;
+        // the smallest run that holds everything that's left, otherwise the largest one so the fork gets as few fragments as possible
+        auto best = runs.end();
+        for (auto it = runs.begin(); it != runs.end(); ++it) {
+            if (it->second == 0) {
+                continue;
+            }
+            if (best == runs.end()) {
+                best = it;
+            } else if (best->second >= needed) {
+                if ((it->second >= needed) && (it->second < best->second)) {
+                    best = it;
+                }
+            } else if (it->second > best->second) {
+                best = it;
+            }
+        }
+        if (best == runs.end()) {
+            throw std::runtime_error("not enough free space on volume");
+        }
+        size_t amount = std::min(needed, best->second);
+        ret.push_back({done * _mdb.drAlBlkSiz, (uint16_t)(best->first + 2), (uint16_t)amount});
+        best->first += amount;
+        best->second -= amount;
+        done += amount;
+    }
+
+    // link the chain
+    for (size_t i = 0; i < ret.size(); i++) {
+        for (uint16_t j = 0; j < ret[i].block_count; j++) {
+            uint16_t block = ret[i].start_block + j;
+            uint16_t next;
+            if ((j + 1) < ret[i].block_count) {
+                next = block + 1;
+            } else {
+                next = (i + 1) < ret.size() ? ret[i + 1].start_block : MFS_ALLOC_BLOCK_MAP_LAST;
+            }
+            _alloc_map[block - 2] = next;
+        }
+    }
+    return ret;
+}
+
+void mfs::free_extents(const std::vector<struct mfs_extent> &extents) {
+    for (const auto &extent : extents) {
+        for (uint16_t j = 0; j < extent.block_count; j++) {
+            _alloc_map[extent.start_block - 2 + j] = MFS_ALLOC_BLOCK_MAP_FREE;
+            _freed_blocks[extent.start_block - 2 + j] = true;
+        }
+    }
+}
+
+void mfs::write_extents(const std::vector<struct mfs_extent> &extents, const void *buf, size_t size) {
+    size_t done = 0;
+    for (const auto &extent : extents) {
+        size_t extent_size = (size_t)extent.block_count * _mdb.drAlBlkSiz;
+        size_t amount = std::min(extent_size, size - done);
+        if (amount != 0) {
+            _image.get()->write((const uint8_t *)buf + done, amount, extent_disk_offset(extent));
+        }
+        if (amount != extent_size) {
+            // don't leave stale data in the unused part of the last block
+            std::vector<uint8_t> zero(extent_size - amount, 0);
+            _image.get()->write(zero.data(), zero.size(), extent_disk_offset(extent) + amount);
+        }
+        done += amount;
+    }
+}
+
+size_t mfs::directory_size(size_t extra_name_len) {
+    size_t offset = 0;
+    for (size_t i = 0; i <= _dirents.size(); i++) {
+        size_t size;
+        if (i < _dirents.size()) {
+            size = dirent_size(_dirents[i].dirent.flNam);
+        } else if (extra_name_len != 0) {
+            size = dirent_size(extra_name_len);
+        } else {
+            break;
+        }
+        // entries don't cross sector boundaries
+        if (((offset % SECTOR_SIZE) + size) > SECTOR_SIZE) {
+            offset += SECTOR_SIZE - (offset % SECTOR_SIZE);
+        }
+        offset += size;
+    }
+    return offset;
+}
+
+void mfs::write_file(const std::string &name, const void *data, size_t data_size, const void *rsrc, size_t rsrc_size, int64_t mtime) {
+    if (!_image.get()->writable()) {
+        throw std::runtime_error("image is read-only");
+    }
+    if (name.empty() || (name.size() > 255) || (name.find(':') != std::string::npos)) {
+        throw std::runtime_error("invalid file name \"" + name + "\"");
+    }
+    if ((data_size > UINT32_MAX) || (rsrc_size > UINT32_MAX)) {
+        throw std::runtime_error("file too large");
+    }
+    size_t data_blocks = (data_size + (_mdb.drAlBlkSiz - 1)) / _mdb.drAlBlkSiz;
+    size_t rsrc_blocks = (rsrc_size + (_mdb.drAlBlkSiz - 1)) / _mdb.drAlBlkSiz;
+    if ((data_blocks + rsrc_blocks) > free_blocks()) {
+        throw std::runtime_error("not enough free space on volume");
+    }
+    struct mfs_dirent_int *existing = find_dirent(name);
+    if ((existing == nullptr) && (directory_size(name.size()) > ((size_t)_mdb.drBlLen * SECTOR_SIZE))) {
+        throw std::runtime_error("directory full");
+    }
+
+    struct mfs_dirent_int entry;
+    if (existing != nullptr) {
+        free_extents(existing->extents[0]);
+        free_extents(existing->extents[1]);
+        entry.dirent = existing->dirent;
+    } else {
+        memset(&entry.dirent, 0, sizeof(entry.dirent));
+        entry.dirent.flFlags = MFS_DIRENT_FLAGS_USED;
+        entry.dirent.flFlNum = _mdb.drNxtFNum++;
+        entry.dirent.flCrDat = unixtime2mac(mtime);
+        entry.dirent.flNam = name.size();
+    }
+    entry.name = name;
+    entry.extents[0] = allocate(data_blocks);
+    entry.extents[1] = allocate(rsrc_blocks);
+    write_extents(entry.extents[0], data, data_size);
+    write_extents(entry.extents[1], rsrc, rsrc_size);
+
+    entry.dirent.flStBlk = entry.extents[0].empty() ? 0 : entry.extents[0].front().start_block;
+    entry.dirent.flLgLen = data_size;
+    entry.dirent.flPyLen = data_blocks * _mdb.drAlBlkSiz;
+    entry.dirent.flRStBlk = entry.extents[1].empty() ? 0 : entry.extents[1].front().start_block;
+    entry.dirent.flRLgLen = rsrc_size;
+    entry.dirent.flRPyLen = rsrc_blocks * _mdb.drAlBlkSiz;
+    entry.dirent.flMdDat = unixtime2mac(mtime);
+
+    if (existing != nullptr) {
+        *existing = entry;
+    } else {
+        _dirents.push_back(entry);
+        build_dirent_hash();
+    }
+    _dirty = true;
+}
+
+bool mfs::remove(const std::string &name) {
+    struct mfs_dirent_int *e = find_dirent(name);
+    if (e == nullptr) {
+        return false;
+    }
+    if (!_image.get()->writable()) {
+        throw std::runtime_error("image is read-only");
+    }
+    free_extents(e->extents[0]);
+    free_extents(e->extents[1]);
+    _dirents.erase(_dirents.begin() + (e - _dirents.data()));
+    build_dirent_hash();
+    _dirty = true;
+    return true;
+}
+
+size_t mfs::free_blocks() {
+    size_t ret = 0;
+    for (size_t i = 0; i < _alloc_map.size(); i++) {
+        if (block_allocatable(i)) {
+            ret++;
+        }
+    }
+    return ret;
+}
+
+void mfs::store_alloc_block_map() {
+    std::vector<uint8_t> packed(mfs_alloc_block_map_size(_alloc_map.size()));
+    mfs_pack_alloc_block_map(_alloc_map.data(), _alloc_map.size(), packed.data());
+    _image.get()->write(packed.data(), packed.size(), MFS_ALLOC_BLOCK_MAP_OFFSET);
+}
+
+void mfs::store_directory() {
+    std::vector<uint8_t> directory((size_t)_mdb.drBlLen * SECTOR_SIZE, 0);
+    size_t offset = 0;
+    for (const auto &e : _dirents) {
+        size_t size = dirent_size(e.dirent.flNam);
+        if (((offset % SECTOR_SIZE) + size) > SECTOR_SIZE) {
+            offset += SECTOR_SIZE - (offset % SECTOR_SIZE);
+        }
+        if ((offset + size) > directory.size()) {
+            throw std::runtime_error("directory full");
+        }
+        mfs_dirent_codec::encode(e.dirent, &directory[offset]);
+        memcpy(&directory[offset + sizeof(struct mfs_dirent)], e.name.data(), e.name.size());
+        offset += size;
+    }
+    _image.get()->write(directory.data(), directory.size(), (size_t)_mdb.drDirSt * SECTOR_SIZE);
+}
+
+void mfs::flush() {
+    if (!_dirty) {
+        return;
+    }
+    // fork data is already on disk at this point, so metadata is written last; the map and the directory are two separate
+    // writes though, an interruption in between leaves blocks the directory still uses marked free
+    store_alloc_block_map();
+    store_directory();
+
+    _mdb.drNmFls = _dirents.size();
+    _mdb.drFreeBks = std::count(_alloc_map.begin(), _alloc_map.end(), (uint16_t)MFS_ALLOC_BLOCK_MAP_FREE);
+    uint8_t mdb_raw[sizeof(struct mfs_mdb)];
+    mfs_mdb_codec::encode(_mdb, mdb_raw);
+    _image.get()->write(mdb_raw, sizeof(mdb_raw), MFS_MDB_OFFSET);
+
+    _freed_blocks.assign(_alloc_map.size(), false);
+    _dirty = false;
+}
+
+struct mfs::mfs_fragmentation mfs::fragmentation() {
+    struct mfs_fragmentation ret = {0, 0, 0, 0, 0, 0};
+    for (const auto &e : _dirents) {
+        for (const auto &extents : e.extents) {
+            if (extents.empty()) {
+                continue;
+            }
+            ret.forks++;
+            ret.extents += extents.size();
+            if (extents.size() > 1) {
+                ret.fragmented_forks++;
+            }
+        }
+    }
+    size_t run = 0;
+    for (size_t i = 0; i < _alloc_map.size(); i++) {
+        if (block_allocatable(i)) {
+            ret.free_blocks++;
+            if (run++ == 0) {
+                ret.free_runs++;
+            }
+            ret.largest_free_run = std::max(ret.largest_free_run, run);
+        } else {
+            run = 0;
+        }
     }
     return ret;
 }
+
+void mfs::defragment() {
+    if (!_image.get()->writable()) {
+        throw std::runtime_error("image is read-only");
+    }
+    std::vector<std::vector<uint8_t>> contents(_dirents.size() * 2);
+    for (size_t i = 0; i < _dirents.size(); i++) {
+        for (int resource_fork = 0; resource_fork < 2; resource_fork++) {
+            const struct mfs_dirent &dirent = _dirents[i].dirent;
+            std::vector<uint8_t> &buf = contents[(i * 2) + resource_fork];
+            buf.resize(resource_fork ? dirent.flRLgLen : dirent.flLgLen);
+            if (read(_dirents[i].name, resource_fork != 0, buf.data(), buf.size(), 0) != buf.size()) {
+                throw std::runtime_error("allocation chain of \"" + _dirents[i].name + "\" is shorter than the file");
+            }
+        }
+    }
+
+    // start over with an empty volume, allocating in directory order on an empty map yields consecutive runs
+    for (auto &value : _alloc_map) {
+        if (value != MFS_ALLOC_BLOCK_MAP_DIRENTS) {
+            value = MFS_ALLOC_BLOCK_MAP_FREE;
+        }
+    }
+    _freed_blocks.assign(_alloc_map.size(), false);
+    for (size_t i = 0; i < _dirents.size(); i++) {
+        struct mfs_dirent_int &e = _dirents[i];
+        for (int resource_fork = 0; resource_fork < 2; resource_fork++) {
+            const std::vector<uint8_t> &buf = contents[(i * 2) + resource_fork];
+            size_t blocks = (buf.size() + (_mdb.drAlBlkSiz - 1)) / _mdb.drAlBlkSiz;
+            e.extents[resource_fork] = allocate(blocks);
+            write_extents(e.extents[resource_fork], buf.data(), buf.size());
+            uint16_t start_block = e.extents[resource_fork].empty() ? 0 : e.extents[resource_fork].front().start_block;
+            if (resource_fork) {
+                e.dirent.flRStBlk = start_block;
+                e.dirent.flRPyLen = blocks * _mdb.drAlBlkSiz;
+            } else {
+                e.dirent.flStBlk = start_block;
+                e.dirent.flPyLen = blocks * _mdb.drAlBlkSiz;
+            }
+        }
+    }
+    _dirty = true;
+    flush();
+}
+
+struct io_stats mfs::stats() const {
+    struct io_stats ret = {_read_calls, _bytes_read, _seeks, _chain_hops, 0, 0};
+    const cached_image *cache = dynamic_cast<const cached_image *>(_image.get());
+    if (cache != nullptr) {
+        ret.cache_hits = cache->stats().hits;
+        ret.cache_misses = cache->stats().misses;
+    }
+    return ret;
+}
+
+void mfs::set_trace(trace_log *log) {
+    _trace = log;
+}
+
+bool parse_thread_count(const char *arg, unsigned int &count) {
+    // strtoul would accept a sign and wrap negative numbers around
+    if ((arg[0] < '0') || (arg[0] > '9')) {
+        return false;
+    }
+    char *end;
+    errno = 0;
+    unsigned long value = strtoul(arg, &end, 10);
+    if ((*end != '\0') || (errno != 0) || (value == 0) || (value > UINT_MAX)) {
+        return false;
+    }
+    count = (unsigned int)value;
+    return true;
+}
+
+void copy_image_file(const char *src, const char *dst) {
+    std::shared_ptr<image> in = open_image(src);
+    struct stat st;
+    if ((in == nullptr) || (stat(src, &st) != 0)) {
+        throw std::runtime_error(std::string("failed to open ") + src + " (" + std::strerror(errno) + ")");
+    }
+    struct stat dst_st;
+    if ((stat(dst, &dst_st) == 0) && (dst_st.st_dev == st.st_dev) && (dst_st.st_ino == st.st_ino)) {
+        throw std::runtime_error(std::string(dst) + " is the image itself");
+    }
+    int outfd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    if (outfd < 0) {
+        throw std::runtime_error(std::string("failed to create ") + dst + " (" + std::strerror(errno) + ")");
+    }
+    try {
+        copy_image_range(*in.get(), 0, in.get()->size(), outfd);
+    } catch (...) {
+        close(outfd);
+        throw;
+    }
+    if (close(outfd) != 0) {
+        throw std::runtime_error(std::string("failed to write ") + dst + " (" + std::strerror(errno) + ")");
+    }
+}
@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <archive.h>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <common.h>
+#include <cstdlib>
+#include <cstring>
+#include <dedup_index.h>
+#include <fcntl.h>
+#include <mactools/diskcopy42.h>
+#include <mactools/hash.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include <workpool.h>
+
+#define HASH_CHUNK_SIZE (64 * 1024)
+
+struct fork_hash {
+    std::string name;
+    bool resource_fork;
+    uint64_t hash;
+    uint32_t size;
+};
+
+struct scan_result {
+    std::vector<struct fork_hash> forks;
+    std::string error;
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-j thread count] [--stats] [index file] [MFS image filename or directory]...\n", name);
+    fprintf(stderr, "       %s --dups [index file]\n", name);
+    fprintf(stderr, "       %s --find [index file] [file]...\n", name);
+    fprintf(stderr, "       %s [-j thread count] --extract [index file] [output directory]\n", name);
+    fprintf(stderr, "  hashes every fork of the images and adds them to the index, images already in the index are read again\n");
+    fprintf(stderr, "  only if their size or modification time changed and dropped if they no longer exist\n");
+    fprintf(stderr, "  --dups: list forks stored more than once\n");
+    fprintf(stderr, "  --find: look up the forks of files on the host\n");
+    fprintf(stderr, "  --extract: write every distinct fork once, named by hash and size; forks already extracted are skipped\n");
+    fprintf(stderr, "  --stats: print I/O counters to stderr\n");
+    exit(1);
+}
+
+static bool stat_image(const std::string &path, uint64_t &size, int64_t &mtime_ns) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    size = (uint64_t)st.st_size;
+    mtime_ns = ((int64_t)st.st_mtim.tv_sec * 1000000000) + st.st_mtim.tv_nsec;
+    return true;
+}
+
+static std::string entry_key(uint64_t hash, uint32_t size) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%016" PRIx64 "-%" PRIu32, hash, size);
+    return buf;
+}
+
+static uint64_t hash_fork(mfs &mfs, const std::string &name, bool resource_fork, size_t size, std::vector<uint8_t> &buf) {
+    xxh64 h;
+    for (size_t offset = 0; offset < size;) {
+        size_t n = mfs.read(name, resource_fork, buf.data(), std::min(buf.size(), size - offset), offset);
+        if (n == 0) {
+            throw std::runtime_error("short read from " + name);
+        }
+        h.update(buf.data(), n);
+        offset += n;
+    }
+    return h.digest();
+}
+
+static void scan_image(mfs &mfs, const std::string &path, struct scan_result &result) {
+    std::shared_ptr<image> img = open_image(path.c_str());
+    if (img == nullptr) {
+        result.error = std::string("Failed to open image file (") + std::strerror(errno) + ")";
+        return;
+    }
+    try {
+        mfs.set_image(dc42_unwrap(img, false));
+        if (!mfs.init_readonly()) {
+            result.error = "Failed to initialize MFS file system";
+        } else {
+            std::vector<uint8_t> buf(HASH_CHUNK_SIZE);
+            for (const auto &e : mfs.readdir()) {
+                if (e.fsize != 0) {
+                    result.forks.push_back({e.name, false, hash_fork(mfs, e.name, false, e.fsize, buf), (uint32_t)e.fsize});
+                }
+                if (e.rsize != 0) {
+                    result.forks.push_back({e.name, true, hash_fork(mfs, e.name, true, e.rsize, buf), (uint32_t)e.rsize});
+                }
+            }
+        }
+    } catch (const std::exception &e) {
+        result.forks.clear();
+        result.error = std::string("Error: ") + e.what();
+    }
+    mfs.set_image(nullptr);
+}
+
+static std::unique_ptr<dedup_index> load_index(const char *path) {
+    try {
+        return std::unique_ptr<dedup_index>(new dedup_index(path));
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s: %s\n", path, e.what());
+        exit(1);
+    }
+}
+
+static int update(const char *index_path, const std::vector<std::string> &args, unsigned int thread_count, bool print_io_stats) {
+    std::unique_ptr<dedup_index> old;
+    std::unordered_map<std::string, size_t> old_images;
+    std::vector<std::string> images;
+    if (access(index_path, F_OK) == 0) {
+        old = load_index(index_path);
+        for (size_t i = 0; i < old->image_count(); i++) {
+            images.push_back(old->image_path(i));
+            old_images[images.back()] = i;
+        }
+    }
+    // absolute paths so the index stays valid when run from elsewhere
+    std::vector<std::string> found;
+    for (const auto &a : args) {
+        collect_images(a, true, found);
+    }
+    for (const auto &f : found) {
+        char resolved[PATH_MAX];
+        images.push_back((realpath(f.c_str(), resolved) != nullptr) ? resolved : f);
+    }
+    std::sort(images.begin(), images.end());
+    images.erase(std::unique(images.begin(), images.end()), images.end());
+
+    // unchanged images keep their entries, everything else is read again
+    struct image_state {
+        std::string path;
+        uint64_t size;
+        int64_t mtime_ns;
+        const std::vector<size_t> *old_entries; // nullptr -> rescan
+    };
+    std::vector<std::vector<size_t>> old_entries(old ? old->image_count() : 0);
+    for (size_t i = 0; old && (i < old->entry_count()); i++) {
+        if (old->entry(i).image < old_entries.size()) {
+            old_entries[old->entry(i).image].push_back(i);
+        }
+    }
+    std::vector<struct image_state> kept;
+    std::vector<size_t> rescan;
+    size_t dropped = 0;
+    for (const auto &path : images) {
+        struct image_state s = {path, 0, 0, nullptr};
+        if (!stat_image(path, s.size, s.mtime_ns)) {
+            dropped++;
+            continue;
+        }
+        auto it = old_images.find(path);
+        if ((it != old_images.end()) && (old->image(it->second).size == s.size) && (old->image(it->second).mtime_ns == s.mtime_ns)) {
+            s.old_entries = &old_entries[it->second];
+        } else {
+            rescan.push_back(kept.size());
+        }
+        kept.push_back(s);
+    }
+
+    std::vector<std::unique_ptr<mfs>> workers;
+    for (unsigned int i = 0; i < std::max(thread_count, 1u); i++) {
+        workers.emplace_back(new mfs());
+    }
+    std::vector<struct scan_result> results(rescan.size());
+    run_work_stealing(rescan.size(), thread_count, [&](unsigned int worker, size_t task) {
+        scan_image(*workers[worker], kept[rescan[task]].path, results[task]);
+    });
+
+    // images that can't be read stay in the index without forks so they aren't tried again until they change
+    dedup_index_writer writer;
+    size_t failed = 0;
+    for (size_t i = 0, r = 0; i < kept.size(); i++) {
+        uint32_t image = writer.add_image(kept[i].path, kept[i].size, kept[i].mtime_ns);
+        if (kept[i].old_entries != nullptr) {
+            for (size_t e : *kept[i].old_entries) {
+                const struct dedup_entry &entry = old->entry(e);
+                writer.add_fork(image, old->name(entry), entry.resource_fork != 0, entry.hash, entry.size);
+            }
+            continue;
+        }
+        const struct scan_result &result = results[r++];
+        if (!result.error.empty()) {
+            fprintf(stderr, "%s: %s\n", kept[i].path.c_str(), result.error.c_str());
+            failed++;
+        }
+        for (const auto &f : result.forks) {
+            writer.add_fork(image, f.name, f.resource_fork, f.hash, f.size);
+        }
+    }
+    // the old mapping has to go before the file is replaced
+    old.reset();
+    try {
+        writer.write(index_path);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s: %s\n", index_path, e.what());
+        return 1;
+    }
+
+    std::unique_ptr<dedup_index> index = load_index(index_path);
+    size_t distinct = 0;
+    uint64_t total_bytes = 0;
+    uint64_t distinct_bytes = 0;
+    for (size_t i = 0; i < index->entry_count(); i++) {
+        const struct dedup_entry &e = index->entry(i);
+        total_bytes += e.size;
+        if ((i == 0) || (index->entry(i - 1).hash != e.hash) || (index->entry(i - 1).size != e.size)) {
+            distinct++;
+            distinct_bytes += e.size;
+        }
+    }
+    fprintf(stderr, "%zu images (%zu read, %zu unchanged, %zu dropped, %zu with errors)\n", kept.size(), rescan.size(),
+            kept.size() - rescan.size(), dropped, failed);
+    fprintf(stderr, "%zu forks, %zu distinct, %" PRIu64 " of %" PRIu64 " bytes distinct\n", index->entry_count(), distinct, distinct_bytes,
+            total_bytes);
+    if (print_io_stats) {
+        struct io_stats stats = {0, 0, 0, 0, 0, 0};
+        for (const auto &w : workers) {
+            add_io_stats(stats, w->stats());
+        }
+        print_stats(stderr, stats, nullptr);
+    }
+    return failed != 0 ? 1 : 0;
+}
+
+static void print_entry(const dedup_index &index, const struct dedup_entry &e) {
+    printf("\t%s\t%s\t%s\n", index.image_path(e.image).c_str(), e.resource_fork ? "rsrc" : "data", index.name(e).c_str());
+}
+
+static int dups(const char *index_path) {
+    std::unique_ptr<dedup_index> index = load_index(index_path);
+    for (size_t i = 0; i < index->entry_count();) {
+        const struct dedup_entry &first = index->entry(i);
+        auto range = index->find(first.hash, first.size);
+        size_t count = range.second - range.first;
+        if (count > 1) {
+            printf("%s\n", entry_key(first.hash, first.size).c_str());
+            for (const struct dedup_entry *e = range.first; e != range.second; e++) {
+                print_entry(*index, *e);
+            }
+        }
+        i += count;
+    }
+    return 0;
+}
+
+static int find(const char *index_path, const std::vector<std::string> &files) {
+    std::unique_ptr<dedup_index> index = load_index(index_path);
+    std::vector<uint8_t> buf(HASH_CHUNK_SIZE);
+    size_t missing = 0;
+    for (const auto &file : files) {
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "%s: Failed to open file (%s)\n", file.c_str(), std::strerror(errno));
+            missing++;
+            continue;
+        }
+        xxh64 h;
+        uint64_t size = 0;
+        ssize_t n;
+        while ((n = read(fd, buf.data(), buf.size())) > 0) {
+            h.update(buf.data(), (size_t)n);
+            size += (uint64_t)n;
+        }
+        close(fd);
+        auto range = (size <= UINT32_MAX) ? index->find(h.digest(), (uint32_t)size) : std::make_pair(nullptr, nullptr);
+        printf("%s\t%s\n", file.c_str(), entry_key(h.digest(), (uint32_t)size).c_str());
+        if (range.first == range.second) {
+            missing++;
+        }
+        for (const struct dedup_entry *e = range.first; e != range.second; e++) {
+            print_entry(*index, *e);
+        }
+    }
+    return missing != 0 ? 1 : 0;
+}
+
+static int extract(const char *index_path, const std::string &outdir, unsigned int thread_count) {
+    std::unique_ptr<dedup_index> index = load_index(index_path);
+    // the first copy of every distinct fork is taken, grouped by image so each image is mounted once
+    std::vector<std::vector<const struct dedup_entry *>> by_image(index->image_count());
+    for (size_t i = 0; i < index->entry_count();) {
+        const struct dedup_entry &first = index->entry(i);
+        auto range = index->find(first.hash, first.size);
+        if ((first.image < by_image.size()) && (access((outdir + "/" + entry_key(first.hash, first.size)).c_str(), F_OK) != 0)) {
+            by_image[first.image].push_back(&first);
+        }
+        i += range.second - range.first;
+    }
+    std::vector<size_t> work;
+    for (size_t i = 0; i < by_image.size(); i++) {
+        if (!by_image[i].empty()) {
+            work.push_back(i);
+        }
+    }
+
+    std::vector<std::unique_ptr<mfs>> workers;
+    for (unsigned int i = 0; i < std::max(thread_count, 1u); i++) {
+        workers.emplace_back(new mfs());
+    }
+    std::vector<std::string> errors(work.size());
+    std::atomic<size_t> written(0);
+    run_work_stealing(work.size(), thread_count, [&](unsigned int worker, size_t task) {
+        size_t image_index = work[task];
+        std::string path = index->image_path(image_index);
+        uint64_t size;
+        int64_t mtime_ns;
+        // the hashes are only valid for the image as it was indexed
+        if (!stat_image(path, size, mtime_ns) || (size != index->image(image_index).size) || (mtime_ns != index->image(image_index).mtime_ns)) {
+            errors[task] = path + ": missing or changed since it was indexed";
+            return;
+        }
+        mfs &mfs = *workers[worker];
+        try {
+            std::shared_ptr<image> img = open_image(path.c_str());
+            if (img == nullptr) {
+                throw std::runtime_error(std::string("failed to open image file (") + std::strerror(errno) + ")");
+            }
+            mfs.set_image(dc42_unwrap(img, false));
+            if (!mfs.init_readonly()) {
+                throw std::runtime_error("failed to initialize MFS file system");
+            }
+            for (const struct dedup_entry *e : by_image[image_index]) {
+                std::string outname = outdir + "/" + entry_key(e->hash, e->size);
+                std::string tmpname = outname + ".tmp";
+                int outfd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (outfd < 0) {
+                    throw std::runtime_error(std::string("failed to open output file (") + std::strerror(errno) + ")");
+                }
+                size_t copied = mfs.copy_to(index->name(*e), e->resource_fork != 0, outfd);
+                close(outfd);
+                if ((copied != e->size) || (rename(tmpname.c_str(), outname.c_str()) != 0)) {
+                    remove(tmpname.c_str());
+                    throw std::runtime_error("failed to extract " + index->name(*e));
+                }
+                written++;
+            }
+        } catch (const std::exception &e) {
+            errors[task] = path + ": " + e.what();
+        }
+        mfs.set_image(nullptr);
+    });
+
+    size_t failed = 0;
+    for (const auto &e : errors) {
+        if (!e.empty()) {
+            fprintf(stderr, "%s\n", e.c_str());
+            failed++;
+        }
+    }
+    fprintf(stderr, "%zu forks extracted, %zu images with errors\n", written.load(), failed);
+    return failed != 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int thread_count = std::thread::hardware_concurrency();
+    bool print_io_stats = false;
+    enum { MODE_UPDATE, MODE_DUPS, MODE_FIND, MODE_EXTRACT } mode = MODE_UPDATE;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-j") == 0) && ((i + 1) < argc)) {
+            if (!parse_thread_count(argv[++i], thread_count)) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_io_stats = true;
+        } else if (strcmp(argv[i], "--dups") == 0) {
+            mode = MODE_DUPS;
+        } else if (strcmp(argv[i], "--find") == 0) {
+            mode = MODE_FIND;
+        } else if (strcmp(argv[i], "--extract") == 0) {
+            mode = MODE_EXTRACT;
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.empty() || ((mode == MODE_DUPS) && (args.size() != 1)) || ((mode == MODE_FIND) && (args.size() < 2)) ||
+        ((mode == MODE_EXTRACT) && (args.size() != 2))) {
+        usage(argv[0]);
+    }
+
+    const char *index_path = args[0].c_str();
+    std::vector<std::string> rest(args.begin() + 1, args.end());
+    // a corrupt index is only noticed when an entry refers to something that isn't there
+    try {
+        switch (mode) {
+        case MODE_DUPS:
+            return dups(index_path);
+        case MODE_FIND:
+            return find(index_path, rest);
+        case MODE_EXTRACT:
+            return extract(index_path, rest[0], thread_count);
+        default:
+            return update(index_path, rest, thread_count, print_io_stats);
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s: %s\n", index_path, e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dedup_index.h>
+#include <stdexcept>
+#include <unordered_map>
+
+static size_t align8(size_t x) {
+    return (x + 7) & ~(size_t)7;
+}
+
+// true if count records of record_size bytes at offset fit into file_size
+static bool table_fits(uint64_t offset, uint64_t count, size_t record_size, size_t file_size) {
+    return (offset <= file_size) && (offset % 8 == 0) && (count <= ((file_size - offset) / record_size));
+}
+
+dedup_index::dedup_index(const char *path) {
+    _file = open_image(path);
+    if (_file == nullptr) {
+        throw std::runtime_error(std::string("failed to open index (") + std::strerror(errno) + ")");
+    }
+    size_t size = _file->size();
+    if (size < sizeof(struct dedup_index_header)) {
+        throw std::runtime_error("not a dedup index");
+    }
+    // the whole file is viewed once, for mmap_image that's just the mapping
+    const uint8_t *data = _file->view(0, size);
+    _header = (const struct dedup_index_header *)data;
+    if ((memcmp(_header->magic, DEDUP_INDEX_MAGIC, sizeof(_header->magic)) != 0) || (_header->version != DEDUP_INDEX_VERSION) ||
+        (_header->byte_order != DEDUP_INDEX_BYTE_ORDER)) {
+        throw std::runtime_error("not a dedup index or one written by another version or architecture");
+    }
+    if (!table_fits(_header->images_offset, _header->image_count, sizeof(struct dedup_image_record), size) ||
+        !table_fits(_header->entries_offset, _header->entry_count, sizeof(struct dedup_entry), size) ||
+        !table_fits(_header->strings_offset, _header->strings_size, 1, size)) {
+        throw std::runtime_error("truncated dedup index");
+    }
+    _images = (const struct dedup_image_record *)(data + _header->images_offset);
+    _entries = (const struct dedup_entry *)(data + _header->entries_offset);
+    _strings = (const char *)(data + _header->strings_offset);
+    // find() is a binary search and the tools step through the index by its results, both rely on the order
+    for (size_t i = 1; i < _header->entry_count; i++) {
+        const struct dedup_entry &a = _entries[i - 1];
+        const struct dedup_entry &b = _entries[i];
+        if ((a.hash > b.hash) || ((a.hash == b.hash) && (a.size > b.size))) {
+            throw std::runtime_error("corrupt dedup index");
+        }
+    }
+}
+
+size_t dedup_index::image_count() const {
+    return _header->image_count;
+}
+
+const struct dedup_image_record &dedup_index::image(size_t index) const {
+    // entries refer to images by number, a corrupt one must not read past the image table
+    if (index >= _header->image_count) {
+        throw std::runtime_error("corrupt dedup index");
+    }
+    return _images[index];
+}
+
+std::string dedup_index::image_path(size_t index) const {
+    const struct dedup_image_record &r = image(index);
+    if ((r.path_offset > _header->strings_size) || (r.path_length > (_header->strings_size - r.path_offset))) {
+        throw std::runtime_error("corrupt dedup index");
+    }
+    return std::string(_strings + r.path_offset, r.path_length);
+}
+
+size_t dedup_index::entry_count() const {
+    return _header->entry_count;
+}
+
+const struct dedup_entry &dedup_index::entry(size_t index) const {
+    return _entries[index];
+}
+
+std::string dedup_index::name(const struct dedup_entry &entry) const {
+    if (((uint64_t)entry.name_offset + entry.name_length) > _header->strings_size) {
+        throw std::runtime_error("corrupt dedup index");
+    }
+    return std::string(_strings + entry.name_offset, entry.name_length);
+}
+
+std::pair<const struct dedup_entry *, const struct dedup_entry *> dedup_index::find(uint64_t hash, uint32_t size) const {
+    struct dedup_entry key = {hash, size, 0, 0, 0, 0, 0};
+    return std::equal_range(_entries, _entries + _header->entry_count, key, [](const struct dedup_entry &a, const struct dedup_entry &b) {
+        return (a.hash != b.hash) ? a.hash < b.hash : a.size < b.size;
+    });
+}
+
+uint32_t dedup_index_writer::add_image(const std::string &path, uint64_t size, int64_t mtime_ns) {
+    _images.push_back({path, size, mtime_ns, 0});
+    return _images.size() - 1;
+}
+
+void dedup_index_writer::add_fork(uint32_t image, const std::string &name, bool resource_fork, uint64_t hash, uint32_t size) {
+    _images[image].fork_count++;
+    _forks.push_back({hash, size, image, name, resource_fork});
+}
+
+void dedup_index_writer::write(const char *path) {
+    std::sort(_forks.begin(), _forks.end(), [](const struct fork &a, const struct fork &b) {
+        if (a.hash != b.hash) {
+            return a.hash < b.hash;
+        }
+        if (a.size != b.size) {
+            return a.size < b.size;
+        }
+        return (a.image != b.image) ? a.image < b.image : a.name < b.name;
+    });
+
+    // the same System files show up on most images, so names are only stored once
+    std::string strings;
+    std::unordered_map<std::string, uint32_t> name_offsets;
+    std::vector<struct dedup_image_record> images;
+    for (const auto &i : _images) {
+        images.push_back({strings.size(), (uint32_t)i.path.size(), i.fork_count, i.size, i.mtime_ns});
+        strings += i.path;
+    }
+    std::vector<struct dedup_entry> entries;
+    for (const auto &f : _forks) {
+        auto it = name_offsets.find(f.name);
+        if (it == name_offsets.end()) {
+            // name offsets are 32 bits, checked before one gets truncated
+            if (strings.size() > UINT32_MAX) {
+                throw std::runtime_error("too many images for a single dedup index");
+            }
+            it = name_offsets.emplace(f.name, (uint32_t)strings.size()).first;
+            strings += f.name;
+        }
+        entries.push_back({f.hash, f.size, f.image, it->second, (uint8_t)f.name.size(), f.resource_fork, 0});
+    }
+
+    struct dedup_index_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DEDUP_INDEX_MAGIC, sizeof(header.magic));
+    header.version = DEDUP_INDEX_VERSION;
+    header.byte_order = DEDUP_INDEX_BYTE_ORDER;
+    header.image_count = images.size();
+    header.entry_count = entries.size();
+    header.images_offset = align8(sizeof(header));
+    header.entries_offset = align8(header.images_offset + (images.size() * sizeof(struct dedup_image_record)));
+    header.strings_offset = align8(header.entries_offset + (entries.size() * sizeof(struct dedup_entry)));
+    header.strings_size = strings.size();
+
+    std::string tmpname = std::string(path) + ".tmp";
+    FILE *f = fopen(tmpname.c_str(), "wb");
+    if (f == nullptr) {
+        throw std::runtime_error(std::string("failed to create index (") + std::strerror(errno) + ")");
+    }
+    // every table starts 8-byte aligned, the records themselves are multiples of 8 bytes
+    bool ok = (fwrite(&header, sizeof(header), 1, f) == 1) && (fwrite(images.data(), sizeof(images[0]), images.size(), f) == images.size()) &&
+              (fwrite(entries.data(), sizeof(entries[0]), entries.size(), f) == entries.size()) &&
+              (fwrite(strings.data(), 1, strings.size(), f) == strings.size());
+    if ((fclose(f) != 0) || !ok || (rename(tmpname.c_str(), path) != 0)) {
+        int err = errno;
+        remove(tmpname.c_str());
+        throw std::runtime_error(std::string("failed to write index (") + std::strerror(err) + ")");
+    }
+}
@@ -0,0 +1,89 @@
+#include <cerrno>
+#include <common.h>
+#include <cstring>
+#include <mactools/diskcopy42.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static void print_fragmentation(const char *label, const struct mfs::mfs_fragmentation &f) {
+    printf("%s: %zu forks, %zu fragmented, %zu runs (%.2f per fork); %zu free blocks in %zu runs, largest %zu\n",
+           label,
+           f.forks,
+           f.fragmented_forks,
+           f.extents,
+           f.forks != 0 ? (double)f.extents / f.forks : 0.0,
+           f.free_blocks,
+           f.free_runs,
+           f.largest_free_run);
+}
+
+int main(int argc, char *argv[]) {
+    bool print_io_stats = false;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            print_io_stats = true;
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if ((args.size() != 1) && (args.size() != 2)) {
+        fprintf(stderr, "Usage: %s [--stats] [MFS image filename] [output image filename]\n", argv[0]);
+        fprintf(stderr, "  without an output image the image is replaced by a defragmented copy, an interrupted run leaves it untouched\n");
+        fprintf(stderr, "  --stats: print I/O counters and phase timings to stderr\n");
+        exit(1);
+    }
+    // defragmenting moves forks over blocks the directory on disk still points to, so it always works on a copy; without an
+    // output image the copy replaces the original once it is complete
+    std::string tmpname = std::string(args[0]) + "." + std::to_string(getpid()) + ".tmp";
+    const char *path = args.size() == 2 ? args[1] : tmpname.c_str();
+    trace_log log;
+    try {
+        {
+            trace_span span(&log, "copy");
+            copy_image_file(args[0], path);
+        }
+
+        std::shared_ptr<image> img = open_image(path, true);
+        if (img == nullptr) {
+            throw std::runtime_error(std::string("failed to open image file (") + std::strerror(errno) + ")");
+        }
+        struct dc42_info dc42;
+        bool is_dc42 = dc42_probe(*img.get(), &dc42);
+        mfs mfs(dc42_unwrap(img, false));
+        mfs.set_trace(&log);
+        bool mounted;
+        {
+            trace_span span(&log, "mount");
+            mounted = mfs.init_readonly();
+        }
+        if (!mounted) {
+            throw std::runtime_error("failed to initialize MFS file system");
+        }
+        print_fragmentation("before", mfs.fragmentation());
+        {
+            trace_span span(&log, "defragment");
+            mfs.defragment();
+            if (is_dc42) {
+                dc42_update_data_checksum(*img.get(), dc42);
+            }
+        }
+        print_fragmentation("after", mfs.fragmentation());
+        if ((args.size() == 1) && (rename(tmpname.c_str(), args[0]) != 0)) {
+            throw std::runtime_error(std::string("failed to replace the image (") + std::strerror(errno) + ")");
+        }
+        if (print_io_stats) {
+            print_stats(stderr, mfs.stats(), &log);
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "error defragmenting image (%s)\n", e.what());
+        if (args.size() == 1) {
+            remove(tmpname.c_str());
+        }
+        return 1;
+    }
+    return 0;
+}
@@ -1,47 +1,369 @@
+#include <algorithm>
+#include <archive.h>
 #include <cinttypes>
 #include <common.h>
 #include <cstring>
 #include <ctime>
-#include <fstream>
+#include <dir_records.h>
+#include <mactools/diskcopy42.h>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <workpool.h>
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s [MFS image filename]\n", argv[0]);
-        exit(1);
+struct dir_result {
+    std::string listing;
+    std::vector<std::string> errors;
+    bool fatal = false; // image couldn't be read at all
+    bool done = false;
+};
+
+// set by --stats and --trace
+static trace_log *mfs_trace = nullptr;
+// set by --mount-cache
+static const char *mount_cache_dir = nullptr;
+
+enum output_format { OUTPUT_TEXT, OUTPUT_JSONL, OUTPUT_BINARY };
+// set by -f
+static enum output_format output_format = OUTPUT_TEXT;
+
+static void add_error(struct dir_result &result, const char *fmt, const char *arg = "") {
+    char buf[256];
+    snprintf(buf, sizeof(buf), fmt, arg);
+    result.errors.push_back(buf);
+}
+
+static void format_listing(mfs &mfs, struct dir_result &result) {
+    result.listing += "fsize    rsize    ctime              mtime             name\n";
+    for (auto e : mfs.readdir()) {
+        char line[64];
+        snprintf(line, sizeof(line), "%08zu %08zu", e.fsize, e.rsize);
+        result.listing += line;
+        time_t t = (time_t)e.ctime;
+        struct tm tm;
+        char buf[18];
+        strftime(buf, sizeof(buf), "%b %d %Y %R", localtime_r(&t, &tm));
+        result.listing += std::string(" ") + buf + " ";
+        t = (time_t)e.mtime;
+        strftime(buf, sizeof(buf), "%b %d %Y %R", localtime_r(&t, &tm));
+        result.listing += std::string(" ") + buf + " ";
+        result.listing += e.name + "\n";
     }
-    auto infile = std::make_shared<std::fstream>(argv[1], std::ios::in | std::ios::binary);
-    if (!infile.get()->is_open()) {
-        fprintf(stderr, "Failed to open input file (%s)\n", std::strerror(errno));
-        exit(1);
+}
+
+// Unicode code points of the Mac OS Roman characters 0x80-0xFF
+static const uint16_t mac_roman[128] = {
+    0x00C4, 0x00C5, 0x00C7, 0x00C9, 0x00D1, 0x00D6, 0x00DC, 0x00E1, 0x00E0, 0x00E2, 0x00E4, 0x00E3, 0x00E5, 0x00E7, 0x00E9, 0x00E8,
+    0x00EA, 0x00EB, 0x00ED, 0x00EC, 0x00EE, 0x00EF, 0x00F1, 0x00F3, 0x00F2, 0x00F4, 0x00F6, 0x00F5, 0x00FA, 0x00F9, 0x00FB, 0x00FC,
+    0x2020, 0x00B0, 0x00A2, 0x00A3, 0x00A7, 0x2022, 0x00B6, 0x00DF, 0x00AE, 0x00A9, 0x2122, 0x00B4, 0x00A8, 0x2260, 0x00C6, 0x00D8,
+    0x221E, 0x00B1, 0x2264, 0x2265, 0x00A5, 0x00B5, 0x2202, 0x2211, 0x220F, 0x03C0, 0x222B, 0x00AA, 0x00BA, 0x03A9, 0x00E6, 0x00F8,
+    0x00BF, 0x00A1, 0x00AC, 0x221A, 0x0192, 0x2248, 0x2206, 0x00AB, 0x00BB, 0x2026, 0x00A0, 0x00C0, 0x00C3, 0x00D5, 0x0152, 0x0153,
+    0x2013, 0x2014, 0x201C, 0x201D, 0x2018, 0x2019, 0x00F7, 0x25CA, 0x00FF, 0x0178, 0x2044, 0x20AC, 0x2039, 0x203A, 0xFB01, 0xFB02,
+    0x2021, 0x00B7, 0x201A, 0x201E, 0x2030, 0x00C2, 0x00CA, 0x00C1, 0x00CB, 0x00C8, 0x00CD, 0x00CE, 0x00CF, 0x00CC, 0x00D3, 0x00D4,
+    0xF8FF, 0x00D2, 0x00DA, 0x00DB, 0x00D9, 0x0131, 0x02C6, 0x02DC, 0x00AF, 0x02D8, 0x02D9, 0x02DA, 0x00B8, 0x02DD, 0x02DB, 0x02C7};
+
+// appends s as a JSON string, Mac OS Roman text is converted to UTF-8, host paths are passed through as they are
+static void append_json_string(std::string &out, const char *s, size_t len, bool is_mac_roman) {
+    out += '"';
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = (uint8_t)s[i];
+        if ((c == '"') || (c == '\\')) {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else if ((c < 0x80) || !is_mac_roman) {
+            out += (char)c;
+        } else {
+            uint16_t u = mac_roman[c - 0x80];
+            if (u < 0x800) {
+                out += (char)(0xC0 | (u >> 6));
+            } else {
+                out += (char)(0xE0 | (u >> 12));
+                out += (char)(0x80 | ((u >> 6) & 0x3F));
+            }
+            out += (char)(0x80 | (u & 0x3F));
+        }
+    }
+    out += '"';
+}
+
+// one JSON object per line, timestamps stay unix timestamps so nothing is formatted per entry
+static void format_jsonl(mfs &mfs, const std::string &path, struct dir_result &result) {
+    std::string image;
+    append_json_string(image, path.data(), path.size(), false);
+    std::string &out = result.listing;
+    for (const auto &e : mfs.readdir()) {
+        out += "{\"image\":";
+        out += image;
+        out += ",\"name\":";
+        append_json_string(out, e.name.data(), e.name.size(), true);
+        char buf[384];
+        snprintf(buf,
+                 sizeof(buf),
+                 ",\"file_number\":%" PRIu32 ",\"data_size\":%zu,\"data_physical_size\":%zu,\"data_start_block\":%u"
+                 ",\"rsrc_size\":%zu,\"rsrc_physical_size\":%zu,\"rsrc_start_block\":%u,\"ctime\":%" PRId64 ",\"mtime\":%" PRId64
+                 ",\"type\":",
+                 e.file_number,
+                 e.fsize,
+                 e.physical_size,
+                 e.start_block,
+                 e.rsize,
+                 e.rsrc_physical_size,
+                 e.rsrc_start_block,
+                 e.ctime,
+                 e.mtime);
+        out += buf;
+        append_json_string(out, (const char *)&e.finder_info[0], 4, true);
+        out += ",\"creator\":";
+        append_json_string(out, (const char *)&e.finder_info[4], 4, true);
+        snprintf(buf, sizeof(buf), ",\"finder_flags\":%u,\"locked\":%s}\n", load_be<uint16_t>(&e.finder_info[8]), e.locked ? "true" : "false");
+        out += buf;
+    }
+}
+
+static void format_binary(mfs &mfs, const std::string &path, size_t image_index, struct dir_result &result) {
+    std::vector<struct mfs::mfs_dirent_abs> files = mfs.readdir();
+    struct dir_image_record header = {(uint32_t)(sizeof(header) + path.size()), DIR_RECORD_IMAGE, (uint32_t)image_index, (uint32_t)files.size()};
+    result.listing.append((const char *)&header, sizeof(header));
+    result.listing += path;
+    for (const auto &e : files) {
+        struct dir_file_record r;
+        r.size = sizeof(r) + e.name.size();
+        r.kind = DIR_RECORD_FILE;
+        r.image = image_index;
+        r.file_number = e.file_number;
+        r.data_size = e.fsize;
+        r.data_physical_size = e.physical_size;
+        r.rsrc_size = e.rsize;
+        r.rsrc_physical_size = e.rsrc_physical_size;
+        r.data_start_block = e.start_block;
+        r.rsrc_start_block = e.rsrc_start_block;
+        r.ctime = e.ctime;
+        r.mtime = e.mtime;
+        memcpy(r.type, &e.finder_info[0], sizeof(r.type));
+        memcpy(r.creator, &e.finder_info[4], sizeof(r.creator));
+        r.finder_flags = load_be<uint16_t>(&e.finder_info[8]);
+        r.flags = e.locked ? DIR_FILE_LOCKED : 0;
+        r.name_length = e.name.size();
+        result.listing.append((const char *)&r, sizeof(r));
+        result.listing += e.name;
+    }
+}
+
+static void format_entries(mfs &mfs, const std::string &path, size_t image_index, struct dir_result &result) {
+    switch (output_format) {
+    case OUTPUT_JSONL:
+        format_jsonl(mfs, path, result);
+        break;
+    case OUTPUT_BINARY:
+        format_binary(mfs, path, image_index, result);
+        break;
+    default:
+        format_listing(mfs, result);
+        break;
     }
-    if (maybe_diskcopy42(*infile.get())) {
-        fprintf(stderr, "This may be a Apple DiskCopy 4.2 image! Extract it before using it with this tool.\n");
+}
+
+static void list_image(mfs &mfs, const std::string &path, size_t image_index, bool verify, struct dir_result &result) {
+    trace_span span(mfs_trace, "list image");
+    // checksums can only be verified by reading the image
+    struct mount_cache_data cache_data;
+    bool cacheable = (mount_cache_dir != nullptr) && !verify && mount_cache_stat(path, cache_data);
+    std::string cache_path = cacheable ? mount_cache_path(mount_cache_dir, path) : std::string();
+    if (cacheable) {
+        std::shared_ptr<mount_cache> cache = open_mount_cache(cache_path, path);
+        if (cache != nullptr) {
+            // a listing only needs the metadata, so the image isn't even opened
+            mfs.set_image(nullptr);
+            mfs.init_from_cache(*cache);
+            format_entries(mfs, path, image_index, result);
+            return;
+        }
+    }
+
+    std::shared_ptr<image> infile = open_image(path.c_str());
+    if (infile == nullptr) {
+        add_error(result, "Failed to open input file (%s)", std::strerror(errno));
+        result.fatal = true;
+        return;
     }
 
     try {
-        mfs mfs(infile);
+        struct dc42_info dc42;
+        cache_data.disk_part_start = 0;
+        if (dc42_probe(*infile.get(), &dc42)) {
+            if (verify && (!dc42_verify_data(*infile.get(), dc42) || !dc42_verify_tags(*infile.get(), dc42))) {
+                add_error(result, "DiskCopy 4.2 checksum invalid");
+            }
+            // mount the disk image stored in the container directly
+            infile = std::make_shared<slice_image>(infile, DC42_HEADER_SIZE, dc42.data_size);
+            cache_data.disk_part_start = DC42_HEADER_SIZE;
+        }
+
+        mfs.set_image(infile);
         if (!mfs.init_readonly()) {
-            fprintf(stderr, "Failed to initialize MFS file system\n");
+            add_error(result, "Failed to initialize MFS file system");
+        } else if (cacheable) {
+            mfs.fill_mount_cache(cache_data);
+            if (!write_mount_cache(cache_path, cache_data)) {
+                add_error(result, "Failed to write mount cache (%s)", std::strerror(errno));
+            }
         }
+        format_entries(mfs, path, image_index, result);
+    } catch (const std::exception &e) {
+        add_error(result, "Error: %s", e.what());
+        result.fatal = true;
+    }
+    // don't keep the last image mapped until the worker gets its next one
+    mfs.set_image(nullptr);
+}
+
+static void report(const struct io_stats &stats, bool print_io_stats, const char *trace_path) {
+    if (print_io_stats) {
+        print_stats(stderr, stats, mfs_trace);
+    }
+    if ((trace_path != nullptr) && !mfs_trace->write_chrome_trace(trace_path)) {
+        fprintf(stderr, "Failed to write trace file (%s)\n", std::strerror(errno));
+    }
+}
 
-        printf("fsize    rsize    ctime              mtime             name\n");
-        for (auto e : mfs.readdir()) {
-            printf("%08zu %08zu", e.fsize, e.rsize);
-            time_t t = (time_t)e.ctime;
-            char buf[18];
-            strftime(buf, sizeof(buf), "%b %d %Y %R", localtime(&t));
-            printf(" %s ", buf);
-            t = (time_t)e.mtime;
-            strftime(buf, sizeof(buf), "%b %d %Y %R", localtime(&t));
-            printf(" %s ", buf);
-            printf("%s\n", e.name.c_str());
+int main(int argc, char *argv[]) {
+    unsigned int thread_count = std::thread::hardware_concurrency();
+    bool verify = false;
+    bool print_io_stats = false;
+    const char *trace_path = nullptr;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-j") == 0) && ((i + 1) < argc)) {
+            if (!parse_thread_count(argv[++i], thread_count)) {
+                args.clear();
+                break;
+            }
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_io_stats = true;
+        } else if ((strcmp(argv[i], "--trace") == 0) && ((i + 1) < argc)) {
+            trace_path = argv[++i];
+        } else if ((strcmp(argv[i], "--mount-cache") == 0) && ((i + 1) < argc)) {
+            mount_cache_dir = argv[++i];
+        } else if ((strcmp(argv[i], "-f") == 0) && ((i + 1) < argc)) {
+            i++;
+            if (strcmp(argv[i], "text") == 0) {
+                output_format = OUTPUT_TEXT;
+            } else if (strcmp(argv[i], "jsonl") == 0) {
+                output_format = OUTPUT_JSONL;
+            } else if (strcmp(argv[i], "binary") == 0) {
+                output_format = OUTPUT_BINARY;
+            } else {
+                args.clear();
+                break;
+            }
+        } else {
+            args.push_back(argv[i]);
         }
+    }
+    if (args.empty()) {
+        fprintf(stderr,
+                "Usage: %s [-j thread count] [-f text|jsonl|binary] [--verify] [--stats] [--trace file] [--mount-cache directory] "
+                "[MFS image filename or directory]...\n",
+                argv[0]);
+        fprintf(stderr, "  -f [text|jsonl|binary]: output format, default text; jsonl and binary include all directory entry fields\n");
+        fprintf(stderr, "    jsonl objects name their image in \"image\", binary output has an image record ahead of the files of each image\n");
+        fprintf(stderr, "    (records are described in dir_records.h)\n");
+        fprintf(stderr, "  --verify: check the checksums of DiskCopy 4.2 images\n");
+        fprintf(stderr, "  --stats: print I/O counters and phase timings to stderr\n");
+        fprintf(stderr, "  --trace [file]: write the phases as Chrome trace event JSON\n");
+        fprintf(stderr, "  --mount-cache [directory]: keep the metadata of every image there and list unchanged images from it\n");
+        exit(1);
+    }
+    trace_log log;
+    if (print_io_stats || (trace_path != nullptr)) {
+        mfs_trace = &log;
+    }
 
-    } catch (const std::exception &e) {
-        fprintf(stderr, "Error: %s\n", e.what());
-        return 1;
+    std::vector<std::string> images;
+    for (const auto &a : args) {
+        collect_images(a, true, images);
+    }
+    if (output_format != OUTPUT_TEXT) {
+        // listings of thousands of images go out in large writes
+        setvbuf(stdout, nullptr, _IOFBF, 1024 * 1024);
+    }
+    if (output_format == OUTPUT_BINARY) {
+        struct dir_stream_header header;
+        memcpy(header.magic, DIR_STREAM_MAGIC, sizeof(header.magic));
+        header.version = DIR_STREAM_VERSION;
+        header.byte_order = DIR_STREAM_BYTE_ORDER;
+        fwrite(&header, sizeof(header), 1, stdout);
+    }
+
+    // a single image is listed without any decoration
+    if ((images.size() == 1) && (args.size() == 1)) {
+        mfs mfs;
+        mfs.set_trace(mfs_trace);
+        struct dir_result result;
+        list_image(mfs, images[0], 0, verify, result);
+        for (const auto &e : result.errors) {
+            fprintf(stderr, "%s\n", e.c_str());
+        }
+        if (output_format == OUTPUT_TEXT) {
+            fputs(result.listing.c_str(), stdout);
+        } else {
+            fwrite(result.listing.data(), 1, result.listing.size(), stdout);
+        }
+        report(mfs.stats(), print_io_stats, trace_path);
+        return result.fatal ? 1 : 0;
+    }
+
+    // every worker reuses one mfs instance, results are printed in input order as soon as all earlier ones are done
+    std::vector<std::unique_ptr<mfs>> workers;
+    for (unsigned int i = 0; i < std::max(thread_count, 1u); i++) {
+        workers.emplace_back(new mfs());
+        workers.back()->set_trace(mfs_trace);
+    }
+    std::vector<struct dir_result> results(images.size());
+    std::mutex output_lock;
+    size_t next_output = 0;
+    run_work_stealing(images.size(), thread_count, [&](unsigned int worker, size_t task) {
+        struct dir_result result;
+        list_image(*workers[worker], images[task], task, verify, result);
+
+        std::lock_guard<std::mutex> lock(output_lock);
+        results[task] = std::move(result);
+        results[task].done = true;
+        while ((next_output < results.size()) && results[next_output].done) {
+            if (output_format == OUTPUT_TEXT) {
+                printf("%s:\n%s\n", images[next_output].c_str(), results[next_output].listing.c_str());
+            } else {
+                fwrite(results[next_output].listing.data(), 1, results[next_output].listing.size(), stdout);
+            }
+            results[next_output].listing.clear();
+            next_output++;
+        }
+    });
+
+    size_t failed = 0;
+    for (size_t i = 0; i < images.size(); i++) {
+        if (results[i].errors.empty()) {
+            continue;
+        }
+        failed++;
+        for (const auto &e : results[i].errors) {
+            fprintf(stderr, "%s: %s\n", images[i].c_str(), e.c_str());
+        }
+    }
+    fprintf(stderr, "%zu images listed, %zu with errors\n", images.size(), failed);
+    struct io_stats stats = {0, 0, 0, 0, 0, 0};
+    for (const auto &w : workers) {
+        add_io_stats(stats, w->stats());
     }
+    report(stats, print_io_stats, trace_path);
 
-    return 0;
+    return failed != 0 ? 1 : 0;
 }
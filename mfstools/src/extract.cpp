@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <common.h>
+#include <cstring>
+#include <fcntl.h>
+#include <mactools/diskcopy42.h>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+struct extract_job {
+    std::string name;
+    std::string path; // output file
+    bool resource_fork;
+    uint16_t first_block; // jobs are sorted by this so the reads of all threads move through the image in order
+};
+
+int main(int argc, char *argv[]) {
+    bool print_io_stats = false;
+    const char *trace_path = nullptr;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            print_io_stats = true;
+        } else if ((strcmp(argv[i], "--trace") == 0) && ((i + 1) < argc)) {
+            trace_path = argv[++i];
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    unsigned int thread_count = std::thread::hardware_concurrency();
+    if (((args.size() != 2) && (args.size() != 3)) || ((args.size() == 3) && !parse_thread_count(args[2], thread_count))) {
+        fprintf(stderr, "Usage: %s [--stats] [--trace file] [MFS image filename] [output directory] [thread count]\n", argv[0]);
+        fprintf(stderr, "  --stats: print I/O counters and phase timings to stderr\n");
+        fprintf(stderr, "  --trace [file]: write the phases as Chrome trace event JSON\n");
+        fprintf(stderr, "  resource forks are written to [output directory]/" RSRC_DIR " under the name of their file\n");
+        exit(1);
+    }
+    std::shared_ptr<image> infile = open_image(args[0]);
+    if (infile == nullptr) {
+        fprintf(stderr, "Failed to open input file (%s)\n", std::strerror(errno));
+        exit(1);
+    }
+    if ((mkdir(args[1], 0755) != 0) && (errno != EEXIST)) {
+        fprintf(stderr, "Failed to create output directory (%s)\n", std::strerror(errno));
+        exit(1);
+    }
+    // stream backed images can't be read from multiple threads
+    if ((thread_count == 0) || !infile->persistent_views()) {
+        thread_count = 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    trace_log log;
+    try {
+        mfs mfs(dc42_unwrap(infile, false));
+        mfs.set_trace(&log);
+        bool mounted;
+        {
+            trace_span span(&log, "mount");
+            mounted = mfs.init_readonly();
+        }
+        if (!mounted) {
+            fprintf(stderr, "Failed to initialize MFS file system\n");
+            return 1;
+        }
+
+        std::vector<struct extract_job> jobs;
+        size_t file_count = 0;
+        bool has_rsrc = false;
+        for (auto e : mfs.readdir()) {
+            file_count++;
+            for (int resource_fork = 0; resource_fork < 2; resource_fork++) {
+                if (resource_fork && (e.rsize == 0)) {
+                    continue;
+                }
+                has_rsrc |= resource_fork != 0;
+                auto extents = mfs.extents(e.name, resource_fork);
+                jobs.push_back({e.name,
+                                std::string(args[1]) + "/" + (resource_fork ? RSRC_DIR "/" : "") + mfs_host_filename(e.name.data(), e.name.size()),
+                                resource_fork != 0,
+                                extents.empty() ? (uint16_t)0 : extents.front().start_block});
+            }
+        }
+
+        // different names can map to the same host name, refuse instead of letting one fork overwrite another
+        std::set<std::string> paths;
+        if (has_rsrc) {
+            paths.insert(std::string(args[1]) + "/" + RSRC_DIR);
+        }
+        for (const auto &job : jobs) {
+            if (!paths.insert(job.path).second) {
+                fprintf(stderr, "Error: more than one fork would be written to %s\n", job.path.c_str());
+                return 1;
+            }
+        }
+        if (has_rsrc && (mkdir((std::string(args[1]) + "/" + RSRC_DIR).c_str(), 0755) != 0) && (errno != EEXIST)) {
+            fprintf(stderr, "Failed to create resource fork directory (%s)\n", std::strerror(errno));
+            return 1;
+        }
+        std::stable_sort(jobs.begin(), jobs.end(), [](const struct extract_job &a, const struct extract_job &b) {
+            return a.first_block < b.first_block;
+        });
+
+        // more threads than forks would just sit idle
+        thread_count = (unsigned int)std::min((size_t)thread_count, std::max(jobs.size(), (size_t)1));
+
+        std::atomic<size_t> next_job(0);
+        std::atomic<uint64_t> bytes(0);
+        std::atomic<bool> failed(false);
+        std::mutex error_lock;
+        auto worker = [&]() {
+            size_t i;
+            while ((i = next_job++) < jobs.size()) {
+                const struct extract_job &job = jobs[i];
+                const std::string &path = job.path;
+                trace_span span(&log, "extract fork");
+                try {
+                    int outfd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                    if (outfd < 0) {
+                        throw std::runtime_error("failed to open output file " + path + " (" + std::strerror(errno) + ")");
+                    }
+                    try {
+                        bytes += mfs.copy_to(job.name, job.resource_fork, outfd);
+                    } catch (...) {
+                        close(outfd);
+                        throw;
+                    }
+                    close(outfd);
+                } catch (const std::exception &e) {
+                    std::lock_guard<std::mutex> lock(error_lock);
+                    fprintf(stderr, "Error: %s\n", e.what());
+                    failed = true;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned int i = 0; i < thread_count; i++) {
+            threads.emplace_back(worker);
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Extracted %zu files (%zu forks, %" PRIu64 " bytes) in %.3fs using %u threads (%.2f MiB/s)\n",
+               file_count,
+               jobs.size(),
+               (uint64_t)bytes,
+               seconds,
+               thread_count,
+               seconds > 0 ? ((double)bytes / (1024 * 1024)) / seconds : 0.0);
+        if (print_io_stats) {
+            print_stats(stderr, mfs.stats(), &log);
+        }
+        if ((trace_path != nullptr) && !log.write_chrome_trace(trace_path)) {
+            fprintf(stderr, "Failed to write trace file (%s)\n", std::strerror(errno));
+        }
+        if (failed) {
+            return 1;
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
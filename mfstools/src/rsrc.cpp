@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cerrno>
+#include <common.h>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mactools/diskcopy42.h>
+#include <mactools/resource.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options] [MFS image filename] [file in MFS image]\n", name);
+    fprintf(stderr, "  lists the resources of one or all files, only the resource maps are read\n");
+    fprintf(stderr, "  -t [type]: only list resources of this type, may be given multiple times\n");
+    fprintf(stderr, "  -x [type] [id] [output file]: write the data of a single resource of the given file\n");
+    fprintf(stderr, "  --stats: print I/O counters and phase timings to stderr\n");
+    exit(1);
+}
+
+static bool parse_type(const char *s, uint32_t *type) {
+    if (strlen(s) != 4) {
+        return false;
+    }
+    *type = RESOURCE_TYPE(s[0], s[1], s[2], s[3]);
+    return true;
+}
+
+static void print_resources(const std::string &file, resource_fork &rsrc, const std::vector<uint32_t> &filter) {
+    for (uint32_t type : rsrc.types()) {
+        if (!filter.empty() && (std::find(filter.begin(), filter.end(), type) == filter.end())) {
+            continue;
+        }
+        char type_str[5] = {(char)(type >> 24), (char)(type >> 16), (char)(type >> 8), (char)type, '\0'};
+        for (const auto &res : rsrc.list(type)) {
+            printf("%s\t%s\t%d\t%s\n", file.c_str(), type_str, res.id, res.name.c_str());
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    bool print_io_stats = false;
+    std::vector<uint32_t> filter;
+    bool extract = false;
+    uint32_t extract_type = 0;
+    int16_t extract_id = 0;
+    const char *extract_path = nullptr;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        uint32_t type;
+        if (strcmp(argv[i], "--stats") == 0) {
+            print_io_stats = true;
+        } else if ((strcmp(argv[i], "-t") == 0) && ((i + 1) < argc) && parse_type(argv[i + 1], &type)) {
+            filter.push_back(type);
+            i++;
+        } else if ((strcmp(argv[i], "-x") == 0) && ((i + 3) < argc) && parse_type(argv[i + 1], &extract_type)) {
+            extract = true;
+            extract_id = (int16_t)strtol(argv[i + 2], nullptr, 0);
+            extract_path = argv[i + 3];
+            i += 3;
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if ((args.size() < 1) || (args.size() > 2) || (extract && (args.size() != 2))) {
+        usage(argv[0]);
+    }
+
+    std::shared_ptr<image> img = open_image(args[0]);
+    if (img == nullptr) {
+        fprintf(stderr, "Failed to open image file (%s)\n", std::strerror(errno));
+        exit(1);
+    }
+    trace_log log;
+    try {
+        mfs mfs(dc42_unwrap(img, false));
+        mfs.set_trace(&log);
+        bool mounted;
+        {
+            trace_span span(&log, "mount");
+            mounted = mfs.init_readonly();
+        }
+        if (!mounted) {
+            fprintf(stderr, "Failed to initialize MFS file system\n");
+            return 1;
+        }
+
+        std::vector<struct mfs::mfs_dirent_abs> files;
+        if (args.size() == 2) {
+            struct mfs::mfs_dirent_abs dirent;
+            if (!mfs.stat(args[1], dirent)) {
+                fprintf(stderr, "File not found on MFS image\n");
+                return 1;
+            }
+            files.push_back(dirent);
+        } else {
+            files = mfs.readdir();
+        }
+
+        if (extract) {
+            trace_span span(&log, "extract resource");
+            const std::string &name = files[0].name;
+            if (files[0].rsize == 0) {
+                fprintf(stderr, "File has no resource fork\n");
+                return 1;
+            }
+            auto read = [&mfs, &name](void *buf, size_t count, size_t offset) { return mfs.read(name, true, buf, count, offset); };
+            resource_fork rsrc(read, files[0].rsize);
+            std::shared_ptr<const std::vector<uint8_t>> data = rsrc.get(extract_type, extract_id);
+            if (data == nullptr) {
+                fprintf(stderr, "Resource not found\n");
+                return 1;
+            }
+            int outfd = open(extract_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (outfd < 0) {
+                fprintf(stderr, "Failed to open output file (%s)\n", std::strerror(errno));
+                return 1;
+            }
+            write_all(outfd, data->data(), data->size());
+            close(outfd);
+        } else {
+            trace_span span(&log, "read resource maps");
+            for (const auto &file : files) {
+                if (file.rsize == 0) {
+                    continue;
+                }
+                const std::string &name = file.name;
+                try {
+                    auto read = [&mfs, &name](void *buf, size_t count, size_t offset) { return mfs.read(name, true, buf, count, offset); };
+                    resource_fork rsrc(read, file.rsize);
+                    print_resources(name, rsrc, filter);
+                } catch (const std::runtime_error &e) {
+                    // a broken resource fork doesn't stop the scan of the other files
+                    fprintf(stderr, "%s: %s\n", name.c_str(), e.what());
+                }
+            }
+        }
+        if (print_io_stats) {
+            print_stats(stderr, mfs.stats(), &log);
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "error reading resources (%s)\n", e.what());
+        return 1;
+    }
+    return 0;
+}
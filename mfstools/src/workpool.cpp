@@ -0,0 +1,72 @@
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <workpool.h>
+
+struct work_queue {
+    std::mutex lock;
+    std::deque<size_t> tasks;
+};
+
+static bool pop_front(struct work_queue &queue, size_t &task) {
+    std::lock_guard<std::mutex> lock(queue.lock);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return true;
+}
+
+static bool pop_back(struct work_queue &queue, size_t &task) {
+    std::lock_guard<std::mutex> lock(queue.lock);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    return true;
+}
+
+void run_work_stealing(size_t task_count, unsigned int thread_count, const std::function<void(unsigned int worker, size_t task)> &fn) {
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    // no task is ever added after this, so a thread that finds every queue empty is done
+    std::vector<std::unique_ptr<struct work_queue>> queues;
+    for (unsigned int i = 0; i < thread_count; i++) {
+        queues.emplace_back(new work_queue());
+    }
+    for (size_t i = 0; i < task_count; i++) {
+        queues[i % thread_count]->tasks.push_back(i);
+    }
+
+    auto worker = [&](unsigned int id) {
+        size_t task;
+        while (true) {
+            if (pop_front(*queues[id], task)) {
+                fn(id, task);
+                continue;
+            }
+            bool stolen = false;
+            for (unsigned int i = 1; (i < thread_count) && !stolen; i++) {
+                stolen = pop_back(*queues[(id + i) % thread_count], task);
+            }
+            if (!stolen) {
+                return;
+            }
+            fn(id, task);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < thread_count; i++) {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto &t : threads) {
+        t.join();
+    }
+}
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <cerrno>
+#include <common.h>
+#include <cstring>
+#include <mactools/diskcopy42.h>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+// inverse of the file name mapping of mfstools-extract
+static std::string mfs_filename(const std::string &path) {
+    size_t slash = path.rfind('/');
+    std::string ret = slash == std::string::npos ? path : path.substr(slash + 1);
+    std::replace(ret.begin(), ret.end(), ':', '/');
+    return ret;
+}
+
+// "dir/name" -> "dir/rsrc/name", where mfstools-extract puts the resource fork of "dir/name"
+static std::string rsrc_path(const std::string &path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        return RSRC_DIR "/" + path;
+    }
+    return path.substr(0, slash + 1) + RSRC_DIR "/" + path.substr(slash + 1);
+}
+
+// "dir/rsrc/name" -> "dir/name", or an empty string if path isn't in a resource fork directory
+static std::string data_path(const std::string &path) {
+    size_t slash = path.rfind('/');
+    if ((slash == std::string::npos) || (slash < strlen(RSRC_DIR))) {
+        return "";
+    }
+    size_t dir = slash - strlen(RSRC_DIR);
+    if ((path.compare(dir, strlen(RSRC_DIR), RSRC_DIR) != 0) || ((dir != 0) && (path[dir - 1] != '/'))) {
+        return "";
+    }
+    return path.substr(0, dir) + path.substr(slash + 1);
+}
+
+// a whole host file, mapped if possible
+struct host_file {
+    std::shared_ptr<image> img;
+    const uint8_t *data;
+    size_t size;
+};
+
+static struct host_file open_host_file(const std::string &path) {
+    struct host_file ret;
+    ret.img = open_image(path.c_str());
+    if (ret.img == nullptr) {
+        throw std::runtime_error("failed to open " + path + " (" + std::strerror(errno) + ")");
+    }
+    ret.size = ret.img.get()->size();
+    ret.data = ret.size != 0 ? ret.img.get()->view(0, ret.size) : nullptr;
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string> deletes;
+    std::vector<std::string> adds;
+    bool print_io_stats = false;
+    const char *output = nullptr;
+    for (int i = 2; i < argc; i++) {
+        if ((strcmp(argv[i], "-d") == 0) && ((i + 1) < argc)) {
+            deletes.push_back(argv[++i]);
+        } else if ((strcmp(argv[i], "-o") == 0) && ((i + 1) < argc)) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_io_stats = true;
+        } else {
+            adds.push_back(argv[i]);
+        }
+    }
+    if ((argc < 3) || (deletes.empty() && adds.empty())) {
+        fprintf(stderr, "Usage: %s [MFS image filename] [--stats] [-o output image] [-d file in image]... [host file]...\n", argv[0]);
+        fprintf(stderr, "  host files are added or replaced, \"" RSRC_DIR "/name\" next to \"name\" is used as its resource fork\n");
+        fprintf(stderr, "  -o [output image]: change a copy of the image, an interrupted run leaves the original untouched\n");
+        fprintf(stderr, "  --stats: print I/O counters and phase timings to stderr\n");
+        exit(1);
+    }
+    const char *path = argv[1];
+    if (output != nullptr) {
+        try {
+            copy_image_file(argv[1], output);
+        } catch (const std::exception &e) {
+            fprintf(stderr, "error copying image (%s)\n", e.what());
+            return 1;
+        }
+        path = output;
+    }
+    std::shared_ptr<image> img = open_image(path, true);
+    if (img == nullptr) {
+        fprintf(stderr, "Failed to open image file (%s)\n", std::strerror(errno));
+        exit(1);
+    }
+
+    trace_log log;
+    try {
+        struct dc42_info dc42;
+        bool is_dc42 = dc42_probe(*img.get(), &dc42);
+        mfs mfs(dc42_unwrap(img, false));
+        mfs.set_trace(&log);
+        std::unique_ptr<trace_span> phase(new trace_span(&log, "mount"));
+        if (!mfs.init_readonly()) {
+            fprintf(stderr, "Failed to initialize MFS file system\n");
+            return 1;
+        }
+        phase.reset(new trace_span(&log, "write files"));
+
+        size_t deleted = 0;
+        for (const auto &name : deletes) {
+            if (mfs.remove(name)) {
+                deleted++;
+            } else {
+                fprintf(stderr, "%s: no such file\n", name.c_str());
+            }
+        }
+
+        // resource forks are picked up together with their data fork
+        std::set<std::string> paths(adds.begin(), adds.end());
+        size_t added = 0;
+        size_t replaced = 0;
+        for (const auto &path : adds) {
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0) {
+                throw std::runtime_error("failed to stat " + path + " (" + std::strerror(errno) + ")");
+            }
+            if ((paths.count(data_path(path)) != 0) || (S_ISDIR(st.st_mode) && (mfs_filename(path) == RSRC_DIR))) {
+                continue;
+            }
+            struct host_file data = open_host_file(path);
+            struct host_file rsrc = {nullptr, nullptr, 0};
+            struct stat rsrc_st;
+            if (stat(rsrc_path(path).c_str(), &rsrc_st) == 0) {
+                rsrc = open_host_file(rsrc_path(path));
+            }
+
+            std::string name = mfs_filename(path);
+            struct mfs::mfs_dirent_abs dirent;
+            if (mfs.stat(name, dirent)) {
+                replaced++;
+            } else {
+                added++;
+            }
+            mfs.write_file(name, data.data, data.size, rsrc.data, rsrc.size, st.st_mtime);
+        }
+
+        // metadata is written once for the whole batch
+        phase.reset(new trace_span(&log, "flush"));
+        mfs.flush();
+        if (is_dc42) {
+            dc42_update_data_checksum(*img.get(), dc42);
+        }
+        phase.reset();
+        printf("Added %zu files, replaced %zu, deleted %zu, %zu blocks free\n", added, replaced, deleted, mfs.free_blocks());
+        if (print_io_stats) {
+            print_stats(stderr, mfs.stats(), &log);
+        }
+    } catch (const std::exception &e) {
+        fprintf(stderr, "error writing image (%s)\n", e.what());
+        return 1;
+    }
+    return 0;
+}